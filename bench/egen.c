@@ -0,0 +1,273 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "emelf.h"
+#include "egen.h"
+
+#define EGEN_NAME_MAX 128
+
+// profiles fit MX-16 address space when linked together
+const struct egen_params egen_profiles[] = {
+	{ "small",    1, 256,  200, 20, 200,    8,   8,  8,  32,  0 },
+	{ "large",    2,  12, 4000, 20, 200,  200, 100, 12,  48,  0 },
+	{ "names",    3,  64,  500, 10, 100, 1000, 500, 24, 120,  0 },
+	{ "sparse",   4,  64,  800, 60,  20,   16,  16,  8,  32,  0 },
+	{ "prefixed", 5,  64,  500, 10, 100, 1000, 500, 12,  48, 50 },
+	{ NULL }
+};
+
+struct egen {
+	const struct egen_params *p;
+	uint32_t rnd;
+	char **names;
+};
+
+// -----------------------------------------------------------------------
+static uint32_t egen_rand(struct egen *g)
+{
+	// xorshift32, so corpora are the same everywhere
+	g->rnd ^= g->rnd << 13;
+	g->rnd ^= g->rnd >> 17;
+	g->rnd ^= g->rnd << 5;
+
+	return g->rnd;
+}
+
+// -----------------------------------------------------------------------
+static char * egen_name(struct egen *g, unsigned id, const char *base)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+	char buf[EGEN_NAME_MAX + 16];
+	unsigned len = 1;
+	unsigned pos = 0;
+
+	while ((len < g->p->name_max) && (len < EGEN_NAME_MAX) && (egen_rand(g) % g->p->name_len)) {
+		len++;
+	}
+
+	// unique prefix from id (no '_' in it), then '_' and random characters
+	// up to the drawn length, or the wrapped name (mod_foo_init for foo_init)
+	buf[pos++] = 'a' + id % 26;
+	for (id /= 26 ; id ; id /= 36) {
+		buf[pos++] = chars[id % 36];
+	}
+	if (base && (pos + 1 + strlen(base) <= EGEN_NAME_MAX)) {
+		buf[pos++] = '_';
+		strcpy(buf + pos, base);
+		return strdup(buf);
+	}
+	if (pos < len) {
+		buf[pos++] = '_';
+	}
+	while (pos < len) {
+		buf[pos++] = chars[egen_rand(g) % (sizeof(chars) - 1)];
+	}
+	buf[pos] = '\0';
+
+	return strdup(buf);
+}
+
+// -----------------------------------------------------------------------
+static int egen_image(struct egen *g, struct emelf *e, unsigned size)
+{
+	unsigned i = 0;
+	uint16_t *image = malloc(size * sizeof(uint16_t));
+	if (!image) {
+		return -1;
+	}
+
+	while (i < size) {
+		if (egen_rand(g) % 100 < g->p->zeros) {
+			unsigned run = 1 + egen_rand(g) % 32;
+			while (run-- && (i < size)) {
+				image[i++] = 0;
+			}
+		} else {
+			image[i++] = egen_rand(g);
+		}
+	}
+
+	int res = emelf_image_append(e, image, size);
+	free(image);
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+static struct emelf * egen_module(struct egen *g, int m, const struct emelf_allocator *a)
+{
+	unsigned i;
+	const struct egen_params *p = g->p;
+	int *sym = NULL;
+	unsigned sym_count = p->symbols + p->externs;
+
+	struct emelf *e = emelf_create_a(EMELF_RELOC, EMELF_CPU_MX16, EMELF_ABI_V1, a);
+	if (!e) {
+		return NULL;
+	}
+
+	unsigned size = p->image - p->image / 4 + egen_rand(g) % (p->image / 2 + 1);
+	if (egen_image(g, e, size) != EMELF_E_OK) {
+		goto cleanup;
+	}
+
+	sym = malloc((sym_count + 1) * sizeof(int));
+	if (!sym) {
+		goto cleanup;
+	}
+
+	// defined symbols: mostly code labels, some absolute constants
+	for (i=0 ; i<p->symbols ; i++) {
+		unsigned flags = EMELF_SYM_GLOBAL;
+		if (egen_rand(g) % 10) {
+			flags |= EMELF_SYM_RELATIVE;
+		}
+		sym[i] = emelf_symbol_add(e, flags, g->names[m * p->symbols + i], egen_rand(g) % size);
+		if (sym[i] < 0) {
+			goto cleanup;
+		}
+	}
+
+	// symbols defined by other modules
+	for (i=0 ; i<p->externs ; i++) {
+		int other = (p->count > 1) ? (m + 1 + egen_rand(g) % (p->count - 1)) % p->count : m;
+		char *name = g->names[other * p->symbols + egen_rand(g) % p->symbols];
+		sym[p->symbols + i] = emelf_symbol_add(e, EMELF_SYM_NOFLAGS, name, 0);
+		if (sym[p->symbols + i] < 0) {
+			goto cleanup;
+		}
+	}
+
+	// relocations in address order: half base, rest symbol references
+	unsigned reloc_count = (unsigned long) size * p->relocs / 1000;
+	if (reloc_count > 65535) {
+		reloc_count = 65535;
+	}
+	for (i=0 ; i<reloc_count ; i++) {
+		unsigned addr = (unsigned long) i * size / reloc_count;
+		unsigned r = egen_rand(g) % 20;
+		int res;
+		if ((r < 10) || !sym_count) {
+			res = emelf_reloc_add(e, addr, EMELF_RELOC_BASE | (r == 0 ? EMELF_RELOC_BYTE : 0), 0);
+		} else {
+			unsigned flags = EMELF_RELOC_SYM | (r == 10 ? EMELF_RELOC_SYM_NEG : 0) | (r == 11 ? EMELF_RELOC_BYTE : 0);
+			res = emelf_reloc_add(e, addr, flags, sym[egen_rand(g) % sym_count]);
+		}
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	free(sym);
+	return e;
+
+cleanup:
+	free(sym);
+	emelf_destroy(e);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+const struct egen_params * egen_profile(const char *name)
+{
+	const struct egen_params *p;
+
+	for (p=egen_profiles ; p->name ; p++) {
+		if (!strcmp(p->name, name)) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+struct emelf ** egen_corpus(const struct egen_params *p, const struct emelf_allocator *a)
+{
+	int i;
+	int created = 0;
+	unsigned name_count = p->count * p->symbols;
+	struct emelf **obj = NULL;
+	struct egen g = {
+		.p = p,
+		.rnd = p->seed ? p->seed : 1,
+	};
+
+	if ((p->count <= 0) || !p->image || !p->name_len || ((p->externs > 0) && !p->symbols)) {
+		return NULL;
+	}
+
+	g.names = calloc(name_count + 1, sizeof(char*));
+	obj = calloc(p->count, sizeof(struct emelf*));
+	if (!g.names || !obj) {
+		goto cleanup;
+	}
+
+	for (i=0 ; i<name_count ; i++) {
+		const char *base = NULL;
+		unsigned first = i - i % p->symbols;
+		if ((i > first) && p->wrapped && (egen_rand(&g) % 100 < p->wrapped)) {
+			base = g.names[first + egen_rand(&g) % (i - first)];
+		}
+		g.names[i] = egen_name(&g, i, base);
+		if (!g.names[i]) {
+			goto cleanup;
+		}
+	}
+
+	for (created=0 ; created<p->count ; created++) {
+		obj[created] = egen_module(&g, created, a);
+		if (!obj[created]) {
+			goto cleanup;
+		}
+	}
+
+	for (i=0 ; i<name_count ; i++) {
+		free(g.names[i]);
+	}
+	free(g.names);
+
+	return obj;
+
+cleanup:
+	if (g.names) {
+		for (i=0 ; i<name_count ; i++) {
+			free(g.names[i]);
+		}
+	}
+	free(g.names);
+	if (obj) {
+		egen_corpus_destroy(obj, created);
+	}
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+void egen_corpus_destroy(struct emelf **obj, int count)
+{
+	int i;
+
+	for (i=0 ; i<count ; i++) {
+		emelf_destroy(obj[i]);
+	}
+	free(obj);
+}
+
+// vim: tabstop=4 autoindent
@@ -0,0 +1,47 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef EGEN_H
+#define EGEN_H
+
+#include "emelf.h"
+
+// Synthetic corpus of relocatable objects that link together: each
+// module defines symbols and uses symbols defined by other modules.
+struct egen_params {
+	const char *name;
+	unsigned seed;
+	int count;			// number of modules
+	unsigned image;		// mean image size in words (+/- 25%)
+	unsigned zeros;		// percent of image words in zero runs
+	unsigned relocs;	// relocations per 1000 image words
+	unsigned symbols;	// symbols defined in each module
+	unsigned externs;	// symbols each module uses from other modules
+	unsigned name_len;	// mean symbol name length (geometric distribution)
+	unsigned name_max;	// max symbol name length
+	unsigned wrapped;	// percent of names wrapping another name of the module
+};
+
+extern const struct egen_params egen_profiles[];
+
+const struct egen_params * egen_profile(const char *name);
+struct emelf ** egen_corpus(const struct egen_params *p, const struct emelf_allocator *a);
+void egen_corpus_destroy(struct emelf **obj, int count);
+
+#endif
+
+// vim: tabstop=4 autoindent
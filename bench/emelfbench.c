@@ -0,0 +1,755 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "emelf.h"
+#include "eswap.h"
+#include "egen.h"
+
+struct corpus {
+	const char *name;
+	int count;
+	struct emelf **obj;		// as generated or loaded
+	struct emelf **self;	// with all symbols defined, for relocation
+	struct emelf_rebase **plan;
+	void **buf;				// serialized objects
+	size_t *size;
+	uint16_t *scratch;
+};
+
+struct bench {
+	const char *name;
+	long (*run)(struct corpus *c, double *bytes);
+	int allocs;				// allocates through object's allocator only
+};
+
+const char *profile;
+double min_time = 0.5;
+char **files;
+int file_count;
+
+// object storage allocations are counted
+unsigned long alloc_count;
+
+// -----------------------------------------------------------------------
+static void * count_alloc(void *ctx, size_t size)
+{
+	alloc_count++;
+	return malloc(size);
+}
+
+// -----------------------------------------------------------------------
+static void * count_realloc(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+	alloc_count++;
+	return realloc(ptr, size);
+}
+
+// -----------------------------------------------------------------------
+static void count_free(void *ctx, void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+const struct emelf_allocator count_allocator = {
+	.alloc = count_alloc,
+	.realloc = count_realloc,
+	.free = count_free,
+	.ctx = NULL,
+};
+
+// -----------------------------------------------------------------------
+static size_t null_write(void *ctx, const void *buf, size_t len)
+{
+	*(size_t*) ctx += len;
+	return len;
+}
+
+// -----------------------------------------------------------------------
+static int null_seek(void *ctx, long offset)
+{
+	return -1;
+}
+
+const struct emelf_io null_io = {
+	.read = NULL,
+	.write = null_write,
+	.seek = null_seek,
+};
+
+// -----------------------------------------------------------------------
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// -----------------------------------------------------------------------
+long bench_load(struct corpus *c, double *bytes)
+{
+	int i;
+
+	for (i=0 ; i<c->count ; i++) {
+		struct emelf_membuf mb = { c->buf[i], c->size[i], 0 };
+		struct emelf *e = emelf_load_io_a(&emelf_io_mem, &mb, &count_allocator);
+		if (!e) {
+			return -1;
+		}
+		emelf_destroy(e);
+		*bytes += c->size[i];
+	}
+
+	return c->count;
+}
+
+// -----------------------------------------------------------------------
+long bench_write(struct corpus *c, double *bytes)
+{
+	int i;
+
+	for (i=0 ; i<c->count ; i++) {
+		size_t len = 0;
+		if (emelf_write_io(c->obj[i], &null_io, &len) != EMELF_E_OK) {
+			return -1;
+		}
+		*bytes += len;
+	}
+
+	return c->count;
+}
+
+// -----------------------------------------------------------------------
+long bench_sym_add(struct corpus *c, double *bytes)
+{
+	int i, j;
+	long ops = 0;
+
+	for (i=0 ; i<c->count ; i++) {
+		struct emelf *src = c->obj[i];
+		struct emelf *e = emelf_create_a(EMELF_RELOC, src->eh.cpu, src->eh.abi, &count_allocator);
+		if (!e) {
+			return -1;
+		}
+		for (j=0 ; j<src->symbol_count ; j++) {
+			char *name = src->symbol_names + src->symbol[j].offset;
+			if (emelf_symbol_add(e, src->symbol[j].flags, name, src->symbol[j].value) < 0) {
+				emelf_destroy(e);
+				return -1;
+			}
+			*bytes += strlen(name) + 1;
+		}
+		ops += src->symbol_count;
+		emelf_destroy(e);
+	}
+
+	return ops;
+}
+
+// -----------------------------------------------------------------------
+long bench_sym_get(struct corpus *c, double *bytes)
+{
+	int i, j;
+	long ops = 0;
+
+	for (i=0 ; i<c->count ; i++) {
+		struct emelf *e = c->obj[i];
+		for (j=0 ; j<e->symbol_count ; j++) {
+			char *name = e->symbol_names + e->symbol[j].offset;
+			if (emelf_symbol_get(e, name) != e->symbol + j) {
+				return -1;
+			}
+			*bytes += strlen(name) + 1;
+		}
+		ops += e->symbol_count;
+	}
+
+	return ops;
+}
+
+// -----------------------------------------------------------------------
+long bench_sym_at(struct corpus *c, double *bytes)
+{
+	int i;
+	unsigned addr;
+	long ops = 0;
+
+	for (i=0 ; i<c->count ; i++) {
+		struct emelf *e = c->obj[i];
+		for (addr=0 ; addr<e->image_size ; addr+=7) {
+			if (emelf_symbol_at(e, addr, 0) < -1) {
+				return -1;
+			}
+			ops++;
+		}
+	}
+
+	return ops;
+}
+
+// -----------------------------------------------------------------------
+long bench_link(struct corpus *c, double *bytes)
+{
+	int i;
+	long ops = 0;
+
+	struct emelf *e = emelf_link(c->obj, c->count, NULL);
+	if (!e) {
+		return -1;
+	}
+	*bytes += e->image_size * sizeof(uint16_t);
+	emelf_destroy(e);
+
+	for (i=0 ; i<c->count ; i++) {
+		ops += c->obj[i]->reloc_count;
+	}
+
+	return ops;
+}
+
+// -----------------------------------------------------------------------
+long bench_relocate(struct corpus *c, double *bytes)
+{
+	int i;
+	long ops = 0;
+
+	for (i=0 ; i<c->count ; i++) {
+		struct emelf *e = c->self[i];
+		if (emelf_relocate(e, 1, 1) != EMELF_E_OK) {
+			return -1;
+		}
+		*bytes += e->image_size * sizeof(uint16_t);
+		ops += e->reloc_count;
+	}
+
+	return ops;
+}
+
+// -----------------------------------------------------------------------
+long bench_rebase(struct corpus *c, double *bytes)
+{
+	int i;
+	long ops = 0;
+
+	for (i=0 ; i<c->count ; i++) {
+		if (emelf_rebase_apply(c->plan[i], 1, c->scratch) != EMELF_E_OK) {
+			return -1;
+		}
+		*bytes += emelf_rebase_size(c->plan[i]) * sizeof(uint16_t);
+		ops += c->self[i]->reloc_count;
+	}
+
+	return ops;
+}
+
+// -----------------------------------------------------------------------
+// Per-word loop the library used before swap kernels. Not inlined, so it
+// isn't specialized (and vectorized) for the constant length here, as it
+// wasn't in the library.
+__attribute__((noinline))
+void swap_htons(uint16_t *t, size_t len)
+{
+	size_t pos;
+	for (pos=0 ; pos<len ; pos++) {
+		t[pos] = htons(t[pos]);
+	}
+}
+
+// full MX-16 image (128 KiB), swapped in place
+uint16_t swap_buf[IMAGE_MAX];
+// kernel to time, NULL for swap_htons()
+const struct eswap_kernel *swap_kernel;
+
+// -----------------------------------------------------------------------
+long bench_swap(struct corpus *c, double *bytes)
+{
+	if (swap_kernel) {
+		swap_kernel->copy(swap_buf, swap_buf, IMAGE_MAX);
+	} else {
+		swap_htons(swap_buf, IMAGE_MAX);
+	}
+	*bytes += sizeof(swap_buf);
+
+	return 1;
+}
+
+// relocation image size and table size for reloc_run()
+#define RELOC_IMAGE (60 * 1024)
+#define RELOC_COUNT 65535 // most an object can have
+#define RELOC_SYMBOLS 256
+
+// object relocated by bench_reloc()
+struct emelf *reloc_obj;
+// threads for emelf_relocate(), -1 for reloc_naive()
+int reloc_threads;
+
+// -----------------------------------------------------------------------
+// Straightforward relocation loop: branches on flags and looks up
+// the symbol for each relocation
+__attribute__((noinline))
+void reloc_naive(struct emelf *e, unsigned base)
+{
+	int i;
+
+	for (i=0 ; i<e->reloc_count ; i++) {
+		struct emelf_reloc *r = e->reloc + i;
+		unsigned byte = r->flags & EMELF_RELOC_BYTE ? 1 : 0;
+		uint16_t v = e->image[r->addr];
+		if (r->flags & EMELF_RELOC_BASE) {
+			v += base << byte;
+		}
+		if (r->flags & EMELF_RELOC_SYM) {
+			struct emelf_symbol *s = e->symbol + r->sym_idx;
+			unsigned sv = s->value;
+			if (s->flags & EMELF_SYM_RELATIVE) {
+				sv = (sv + base) << byte;
+			}
+			if (r->flags & EMELF_RELOC_SYM_NEG) {
+				v -= sv;
+			} else {
+				v += sv;
+			}
+		}
+		e->image[r->addr] = v;
+	}
+}
+
+// -----------------------------------------------------------------------
+long bench_reloc(struct corpus *c, double *bytes)
+{
+	struct emelf *e = reloc_obj;
+
+	if (reloc_threads < 0) {
+		reloc_naive(e, 1);
+	} else if (emelf_relocate(e, 1, reloc_threads) != EMELF_E_OK) {
+		return -1;
+	}
+	*bytes += e->image_size * sizeof(uint16_t);
+
+	return e->reloc_count;
+}
+
+struct bench benches[] = {
+	{ "load", bench_load, 1 },
+	{ "write", bench_write, 1 },
+	{ "sym-add", bench_sym_add, 1 },
+	{ "sym-get", bench_sym_get, 1 },
+	{ "sym-at", bench_sym_at, 1 },
+	{ "link", bench_link, 0 },
+	{ "relocate", bench_relocate, 0 },
+	{ "rebase", bench_rebase, 0 },
+	{ NULL }
+};
+
+// -----------------------------------------------------------------------
+// Returns ops/s, or -1 if the benchmark failed
+double bench_run(struct corpus *c, struct bench *b)
+{
+	long ops = 0;
+	long iters = 0;
+	double bytes = 0;
+	unsigned long allocs = alloc_count;
+	double start = now();
+	double elapsed;
+
+	do {
+		long res = b->run(c, &bytes);
+		if (res < 0) {
+			printf("%-8s %-9s failed\n", c->name, b->name);
+			return -1;
+		}
+		ops += res;
+		iters++;
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+
+	allocs = alloc_count - allocs;
+
+	printf("%-8s %-9s %12.0f ", c->name, b->name, ops / elapsed);
+	if (bytes > 0) {
+		printf("%10.1f ", bytes / elapsed / 1e6);
+	} else {
+		printf("%10s ", "-");
+	}
+	if (b->allocs) {
+		printf("%9.2f\n", ops ? (double) allocs / ops : 0.0);
+	} else {
+		printf("%9s\n", "-");
+	}
+
+	return ops / elapsed;
+}
+
+// -----------------------------------------------------------------------
+// Time each swap kernel the CPU supports against the per-word loop
+void swap_run()
+{
+	int i;
+	int count;
+	double base;
+	double rate[8];
+	struct corpus c;
+	struct bench b = { "htons", bench_swap, 0 };
+	const struct eswap_kernel *k = eswap_kernels(&count);
+
+	memset(&c, 0, sizeof(c));
+	c.name = "swap";
+
+	swap_kernel = NULL;
+	base = bench_run(&c, &b);
+	for (i=0 ; i<count ; i++) {
+		swap_kernel = k + i;
+		b.name = k[i].name;
+		rate[i] = bench_run(&c, &b);
+	}
+
+	if (base <= 0) {
+		return;
+	}
+	printf("%-8s %-9s", c.name, "speedup");
+	for (i=0 ; i<count ; i++) {
+		printf(" %s %.1fx", k[i].name, rate[i] / base);
+	}
+	printf(" (vs htons, %s used)\n", k[count-1].name);
+}
+
+// -----------------------------------------------------------------------
+// Relocate a 64K-relocation image with the naive loop, one thread,
+// several threads and automatic thread count
+void reloc_run()
+{
+	int i;
+	int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t rnd = 1;
+	char name[4][16];
+	int threads[4] = { -1, 1, cpus > 2 ? cpus : 2, 0 };
+	double rate[4];
+	struct corpus c;
+	struct bench b = { NULL, bench_reloc, 0 };
+
+	reloc_obj = emelf_create(EMELF_RELOC, EMELF_CPU_MX16, EMELF_ABI_V1);
+	if (!reloc_obj) {
+		goto cleanup;
+	}
+
+	// random mix of flags over the whole image, all symbols defined
+	for (i=0 ; i<RELOC_COUNT+RELOC_IMAGE+RELOC_SYMBOLS ; i++) {
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		if (i < RELOC_SYMBOLS) {
+			sprintf(name[0], "sym%i", i);
+			if (emelf_symbol_add(reloc_obj, EMELF_SYM_GLOBAL | (rnd & EMELF_SYM_RELATIVE), name[0], rnd >> 16) < 0) {
+				goto cleanup;
+			}
+		} else if (i < RELOC_SYMBOLS+RELOC_IMAGE) {
+			uint16_t w = rnd;
+			if (emelf_image_append(reloc_obj, &w, 1) != EMELF_E_OK) {
+				goto cleanup;
+			}
+		} else if (emelf_reloc_add(reloc_obj, (rnd >> 8) % RELOC_IMAGE, rnd & 15, (rnd >> 24) % RELOC_SYMBOLS) != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	memset(&c, 0, sizeof(c));
+	c.name = "reloc64k";
+	for (i=0 ; i<4 ; i++) {
+		if (threads[i] < 0) {
+			strcpy(name[i], "naive");
+		} else if (threads[i] == 0) {
+			strcpy(name[i], "auto");
+		} else {
+			sprintf(name[i], "threads-%i", threads[i]);
+		}
+		b.name = name[i];
+		reloc_threads = threads[i];
+		rate[i] = bench_run(&c, &b);
+	}
+
+	if (rate[0] > 0) {
+		printf("%-8s %-9s", c.name, "speedup");
+		for (i=1 ; i<4 ; i++) {
+			printf(" %s %.1fx", name[i], rate[i] / rate[0]);
+		}
+		printf(" (vs naive)\n");
+	}
+
+	emelf_destroy(reloc_obj);
+	return;
+
+cleanup:
+	printf("Cannot create relocation image.\n");
+	emelf_destroy(reloc_obj);
+}
+
+// -----------------------------------------------------------------------
+struct emelf * self_contained(struct emelf *src)
+{
+	int i;
+	struct emelf *e = emelf_create_a(EMELF_RELOC, src->eh.cpu, src->eh.abi, &count_allocator);
+	if (!e) {
+		return NULL;
+	}
+
+	// undefined symbols become absolute zeros
+	if (emelf_image_append(e, src->image, src->image_size) != EMELF_E_OK) {
+		goto cleanup;
+	}
+	for (i=0 ; i<src->symbol_count ; i++) {
+		struct emelf_symbol *s = src->symbol + i;
+		if (emelf_symbol_add(e, s->flags | EMELF_SYM_GLOBAL, src->symbol_names + s->offset, s->value) < 0) {
+			goto cleanup;
+		}
+	}
+	for (i=0 ; i<src->reloc_count ; i++) {
+		struct emelf_reloc *r = src->reloc + i;
+		if (emelf_reloc_add(e, r->addr, r->flags, r->sym_idx) != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	return e;
+
+cleanup:
+	emelf_destroy(e);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+void corpus_destroy(struct corpus *c)
+{
+	int i;
+
+	for (i=0 ; i<c->count ; i++) {
+		if (c->obj) emelf_destroy(c->obj[i]);
+		if (c->self) emelf_destroy(c->self[i]);
+		if (c->plan) emelf_rebase_destroy(c->plan[i]);
+		if (c->buf) free(c->buf[i]);
+	}
+	free(c->obj);
+	free(c->self);
+	free(c->plan);
+	free(c->buf);
+	free(c->size);
+	free(c->scratch);
+}
+
+// -----------------------------------------------------------------------
+int corpus_prepare(struct corpus *c)
+{
+	int i;
+	unsigned max_size = 0;
+
+	c->self = calloc(c->count, sizeof(struct emelf*));
+	c->plan = calloc(c->count, sizeof(struct emelf_rebase*));
+	c->buf = calloc(c->count, sizeof(void*));
+	c->size = calloc(c->count, sizeof(size_t));
+	if (!c->self || !c->plan || !c->buf || !c->size) {
+		return -1;
+	}
+
+	for (i=0 ; i<c->count ; i++) {
+		if (emelf_write_mem(c->obj[i], c->buf + i, c->size + i) != EMELF_E_OK) {
+			return -1;
+		}
+		c->self[i] = self_contained(c->obj[i]);
+		if (!c->self[i]) {
+			return -1;
+		}
+		c->plan[i] = emelf_rebase_compile(c->self[i]);
+		if (!c->plan[i]) {
+			return -1;
+		}
+		if (c->obj[i]->image_size > max_size) {
+			max_size = c->obj[i]->image_size;
+		}
+	}
+
+	c->scratch = malloc((max_size + 1) * sizeof(uint16_t));
+	if (!c->scratch) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int corpus_load(struct corpus *c)
+{
+	int i;
+
+	c->name = "files";
+	c->obj = calloc(file_count, sizeof(struct emelf*));
+	if (!c->obj) {
+		return -1;
+	}
+
+	for (i=0 ; i<file_count ; i++) {
+		FILE *f = fopen(files[i], "r");
+		if (!f) {
+			printf("Cannot open input file '%s'.\n", files[i]);
+			return -1;
+		}
+		c->obj[i] = emelf_load_io_a(&emelf_io_stdio, f, &count_allocator);
+		fclose(f);
+		c->count = i + 1;
+		if (!c->obj[i]) {
+			printf("Cannot load input file '%s'.\n", files[i]);
+			return -1;
+		}
+		if (c->obj[i]->eh.type != EMELF_RELOC) {
+			printf("Input file '%s' is not a relocatable object.\n", files[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int corpus_bench(struct corpus *c)
+{
+	struct bench *b;
+
+	if (corpus_prepare(c)) {
+		printf("Cannot prepare corpus '%s'.\n", c->name);
+		return -1;
+	}
+
+	for (b=benches ; b->name ; b++) {
+		bench_run(c, b);
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+void usage()
+{
+	const struct egen_params *p;
+
+	printf("Usage: emelfbench [options] [file ...]\n");
+	printf("Where options are:\n");
+	printf("   -p profile : benchmark generated corpus of given profile only\n");
+	printf("   -t seconds : minimum time for each benchmark (default: 0.5)\n");
+	printf("   -v         : print version end exit\n");
+	printf("   -h         : print help and exit\n");
+	printf("Relocatable objects given as files are benchmarked instead of generated corpora.\n");
+	printf("Allocations are counted for object storage (emelf_allocator) only.\n");
+	printf("Profiles:");
+	for (p=egen_profiles ; p->name ; p++) {
+		printf(" %s", p->name);
+	}
+	printf("\n");
+}
+
+// -----------------------------------------------------------------------
+int parse_args(int argc, char **argv)
+{
+	int option;
+	while ((option = getopt(argc, argv,"p:t:vh")) != -1) {
+		switch (option) {
+			case 'p':
+				if (!egen_profile(optarg)) {
+					printf("Unknown profile: %s\n", optarg);
+					return -1;
+				}
+				profile = optarg;
+				break;
+			case 't':
+				min_time = atof(optarg);
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break;
+			case 'v':
+				printf("EMELFBENCH v%s - EMELF benchmarks\n", EMELF_VERSION);
+				exit(0);
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	files = argv + optind;
+	file_count = argc - optind;
+
+	if (profile && file_count) {
+		printf("Option -p cannot be used with input files.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	const struct egen_params *p;
+	int ret = 0;
+
+	if (parse_args(argc, argv)) {
+		exit(1);
+	}
+
+	printf("%-8s %-9s %12s %10s %9s\n", "Corpus", "Benchmark", "ops/s", "MB/s", "allocs/op");
+
+	if (file_count) {
+		struct corpus c;
+		memset(&c, 0, sizeof(c));
+		ret = corpus_load(&c) || corpus_bench(&c);
+		corpus_destroy(&c);
+		return ret;
+	}
+
+	// byte swapping and large table relocation don't depend on corpus,
+	// they're run once
+	if (!profile) {
+		swap_run();
+		reloc_run();
+	}
+
+	for (p=egen_profiles ; p->name ; p++) {
+		struct corpus c;
+		if (profile && strcmp(profile, p->name)) {
+			continue;
+		}
+		memset(&c, 0, sizeof(c));
+		c.name = p->name;
+		c.count = p->count;
+		c.obj = egen_corpus(p, &count_allocator);
+		if (!c.obj) {
+			printf("Cannot generate corpus '%s'.\n", p->name);
+			return 1;
+		}
+		ret |= corpus_bench(&c);
+		corpus_destroy(&c);
+	}
+
+	return ret;
+}
+
+// vim: tabstop=4 autoindent
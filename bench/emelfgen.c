@@ -0,0 +1,170 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "emelf.h"
+#include "egen.h"
+
+struct egen_params params;
+char *outdir = ".";
+
+// -----------------------------------------------------------------------
+void usage()
+{
+	const struct egen_params *p;
+
+	printf("Usage: emelfgen [options]\n");
+	printf("Where options are:\n");
+	printf("   -p profile : start with profile parameters (default: small)\n");
+	printf("   -n count   : number of modules\n");
+	printf("   -i words   : mean image size (+/- 25%%)\n");
+	printf("   -z percent : image words in zero runs\n");
+	printf("   -r relocs  : relocations per 1000 image words\n");
+	printf("   -s count   : symbols defined in each module\n");
+	printf("   -x count   : symbols each module uses from other modules\n");
+	printf("   -l length  : mean symbol name length\n");
+	printf("   -L length  : max symbol name length\n");
+	printf("   -w percent : names wrapping another name of the module\n");
+	printf("   -S seed    : random seed\n");
+	printf("   -o dir     : output directory (default: current directory)\n");
+	printf("   -v         : print version end exit\n");
+	printf("   -h         : print help and exit\n");
+	printf("Profiles:");
+	for (p=egen_profiles ; p->name ; p++) {
+		printf(" %s", p->name);
+	}
+	printf("\n");
+}
+
+// -----------------------------------------------------------------------
+int parse_args(int argc, char **argv)
+{
+	int option;
+	const struct egen_params *p;
+
+	params = *egen_profile("small");
+
+	while ((option = getopt(argc, argv,"p:n:i:z:r:s:x:l:L:w:S:o:vh")) != -1) {
+		switch (option) {
+			case 'p':
+				p = egen_profile(optarg);
+				if (!p) {
+					printf("Unknown profile: %s\n", optarg);
+					return -1;
+				}
+				params = *p;
+				break;
+			case 'n':
+				params.count = atoi(optarg);
+				break;
+			case 'i':
+				params.image = atoi(optarg);
+				break;
+			case 'z':
+				params.zeros = atoi(optarg);
+				break;
+			case 'r':
+				params.relocs = atoi(optarg);
+				break;
+			case 's':
+				params.symbols = atoi(optarg);
+				break;
+			case 'x':
+				params.externs = atoi(optarg);
+				break;
+			case 'l':
+				params.name_len = atoi(optarg);
+				break;
+			case 'L':
+				params.name_max = atoi(optarg);
+				break;
+			case 'w':
+				params.wrapped = atoi(optarg);
+				break;
+			case 'S':
+				params.seed = atoi(optarg);
+				break;
+			case 'o':
+				outdir = optarg;
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break;
+			case 'v':
+				printf("EMELFGEN v%s - EMELF corpus generator\n", EMELF_VERSION);
+				exit(0);
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	if (optind < argc) {
+		printf("Wrong usage.\n");
+		usage();
+		return -1;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	int i;
+	int ret = 1;
+	struct emelf **obj;
+	char path[4096];
+
+	if (parse_args(argc, argv)) {
+		exit(1);
+	}
+
+	obj = egen_corpus(&params, NULL);
+	if (!obj) {
+		printf("Cannot generate corpus (wrong parameters or memory allocation error).\n");
+		exit(1);
+	}
+
+	for (i=0 ; i<params.count ; i++) {
+		snprintf(path, sizeof(path), "%s/m%04i.e", outdir, i);
+		FILE *f = fopen(path, "w");
+		if (!f) {
+			printf("Cannot open output file '%s'.\n", path);
+			goto cleanup;
+		}
+		int res = emelf_write(obj[i], f);
+		fclose(f);
+		if (res != EMELF_E_OK) {
+			printf("Cannot write output file '%s'.\n", path);
+			goto cleanup;
+		}
+	}
+
+	ret = 0;
+
+cleanup:
+	egen_corpus_destroy(obj, params.count);
+	return ret;
+}
+
+// vim: tabstop=4 autoindent
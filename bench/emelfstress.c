@@ -0,0 +1,294 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "emelf.h"
+#include "egen.h"
+
+// Threads load, modify and write objects at the same time, check that
+// errors they cause are reported to them only, and race the first
+// (index-building) symbol lookup on shared objects.
+
+int threads = 16;
+int iterations = 500;
+int rounds = 4;
+
+int count;
+struct emelf **obj;
+void **buf;
+size_t *size;
+void **buf_v0;
+size_t *size_v0;
+struct emelf **shared;
+
+// -----------------------------------------------------------------------
+void usage()
+{
+	printf("Usage: emelfstress [options]\n");
+	printf("Where options are:\n");
+	printf("   -t threads : number of threads (default: 16)\n");
+	printf("   -n count   : iterations in each thread (default: 500)\n");
+	printf("   -r count   : rounds, each with new shared objects (default: 4)\n");
+	printf("   -v         : print version end exit\n");
+	printf("   -h         : print help and exit\n");
+}
+
+// -----------------------------------------------------------------------
+int parse_args(int argc, char **argv)
+{
+	int option;
+
+	while ((option = getopt(argc, argv,"t:n:r:vh")) != -1) {
+		switch (option) {
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break;
+			case 'v':
+				printf("EMELFSTRESS v%s - EMELF thread stress test\n", EMELF_VERSION);
+				exit(0);
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	if ((optind < argc) || (threads <= 0) || (iterations <= 0) || (rounds <= 0)) {
+		printf("Wrong usage.\n");
+		usage();
+		return -1;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+const char * stress_error(long id, int i)
+{
+	static const char garbage[] = "not an EMELF object, not even close";
+	struct emelf *e;
+
+	// threads cause different errors, each has to see its own
+	if (id % 2) {
+		e = emelf_load_mem(garbage, sizeof(garbage));
+		if (e || (emelf_error() != EMELF_E_MAGIC)) {
+			emelf_destroy(e);
+			return "load of garbage didn't fail with EMELF_E_MAGIC";
+		}
+	} else {
+		// modules use symbols of other modules
+		e = emelf_link(obj + i % count, 1, NULL);
+		if (e || (emelf_error() != EMELF_E_UNDEF)) {
+			emelf_destroy(e);
+			return "linking a single module didn't fail with EMELF_E_UNDEF";
+		}
+	}
+
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+const char * stress_object(long id, int i)
+{
+	int j;
+	int m = i % count;
+	char name[32];
+	void *out = NULL;
+	size_t out_size;
+	const char *err = NULL;
+	struct emelf *l2 = NULL;
+
+	struct emelf *l = emelf_load_mem(buf[m], size[m]);
+	if (!l) {
+		return "cannot load object";
+	}
+
+	// first lookups on shared objects build their index concurrently
+	for (j=0 ; j<l->symbol_count ; j++) {
+		char *sym_name = l->symbol_names + l->symbol[j].offset;
+		struct emelf_symbol *s = emelf_symbol_get(l, sym_name);
+		struct emelf_symbol *ss = emelf_symbol_get(shared[m], sym_name);
+		if (!s || !ss || (s->value != ss->value)) {
+			err = "symbol lookup failed";
+			goto cleanup;
+		}
+	}
+
+	snprintf(name, sizeof(name), "stress_%li_%i", id, i);
+	if (emelf_symbol_add(l, EMELF_SYM_GLOBAL, name, i) < 0) {
+		err = "cannot add symbol";
+		goto cleanup;
+	}
+	if (emelf_write_mem(l, &out, &out_size) != EMELF_E_OK) {
+		err = "cannot write object";
+		goto cleanup;
+	}
+	l2 = emelf_load_mem(out, out_size);
+	if (!l2) {
+		err = "cannot load written object";
+		goto cleanup;
+	}
+	struct emelf_symbol *s = emelf_symbol_get(l2, name);
+	if (!s || (s->value != (uint16_t) i) || (l2->symbol_count != l->symbol_count)) {
+		err = "written object lost its symbols";
+		goto cleanup;
+	}
+	if ((l2->image_size != l->image_size) || memcmp(l2->image, l->image, l->image_size * sizeof(uint16_t))) {
+		err = "written object lost its image";
+		goto cleanup;
+	}
+
+cleanup:
+	emelf_destroy(l);
+	emelf_destroy(l2);
+	free(out);
+	return err;
+}
+
+// -----------------------------------------------------------------------
+void * stress_thread(void *arg)
+{
+	long id = (long) arg;
+	int i;
+	const char *err = NULL;
+
+	for (i=0 ; (i<iterations) && !err ; i++) {
+		err = (i % 4) ? stress_object(id, i) : stress_error(id, i);
+	}
+
+	if (err) {
+		printf("Thread %li, iteration %i: %s.\n", id, i-1, err);
+	}
+
+	return (void*) err;
+}
+
+// -----------------------------------------------------------------------
+int stress_round()
+{
+	int i;
+	long t;
+	int ret = 0;
+	pthread_t *tid = calloc(threads, sizeof(pthread_t));
+
+	// version 0 objects don't have a hash index, it's built on first lookup
+	for (i=0 ; i<count ; i++) {
+		shared[i] = emelf_load_mem(buf_v0[i], size_v0[i]);
+		if (!shared[i]) {
+			printf("Cannot load version 0 object.\n");
+			ret = -1;
+		}
+	}
+
+	for (t=0 ; (t<threads) && !ret ; t++) {
+		if (pthread_create(tid + t, NULL, stress_thread, (void*) t)) {
+			printf("Cannot start thread.\n");
+			ret = -1;
+		}
+	}
+	while (t-- > 0) {
+		void *res;
+		pthread_join(tid[t], &res);
+		if (res) {
+			ret = -1;
+		}
+	}
+
+	for (i=0 ; i<count ; i++) {
+		emelf_destroy(shared[i]);
+	}
+	free(tid);
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	int i;
+	int ret = 1;
+	const struct egen_params *p = egen_profile("small");
+
+	if (parse_args(argc, argv)) {
+		exit(1);
+	}
+
+	count = p->count;
+	obj = egen_corpus(p, NULL);
+	buf = calloc(count, sizeof(void*));
+	size = calloc(count, sizeof(size_t));
+	buf_v0 = calloc(count, sizeof(void*));
+	size_v0 = calloc(count, sizeof(size_t));
+	shared = calloc(count, sizeof(struct emelf*));
+	if (!obj || !buf || !size || !buf_v0 || !size_v0 || !shared) {
+		printf("Cannot generate corpus.\n");
+		goto cleanup;
+	}
+
+	for (i=0 ; i<count ; i++) {
+		int res = emelf_write_mem(obj[i], buf + i, size + i);
+		if (res == EMELF_E_OK) {
+			obj[i]->eh.version = 0;
+			res = emelf_write_mem(obj[i], buf_v0 + i, size_v0 + i);
+			obj[i]->eh.version = EMELF_VER;
+		}
+		if (res != EMELF_E_OK) {
+			printf("Cannot write corpus object.\n");
+			goto cleanup;
+		}
+	}
+
+	for (i=0 ; i<rounds ; i++) {
+		if (stress_round()) {
+			goto cleanup;
+		}
+	}
+
+	printf("%i threads, %i rounds of %i iterations: OK\n", threads, rounds, iterations);
+	ret = 0;
+
+cleanup:
+	for (i=0 ; i<count ; i++) {
+		if (buf) free(buf[i]);
+		if (buf_v0) free(buf_v0[i]);
+	}
+	if (obj) {
+		egen_corpus_destroy(obj, count);
+	}
+	free(buf);
+	free(size);
+	free(buf_v0);
+	free(size_v0);
+	free(shared);
+	return ret;
+}
+
+// vim: tabstop=4 autoindent
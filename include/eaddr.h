@@ -0,0 +1,47 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef EADDR_H
+#define EADDR_H
+
+#include <inttypes.h>
+
+struct emelf;
+
+// Address-to-symbol index: defined symbols sorted by value, kept
+// separately for absolute and relative symbols (the latter are
+// shifted by load base at query time). Values and symbol indexes
+// are stored in separate arrays, so searches touch values only.
+
+struct eaddr_list {
+	unsigned count;
+	uint16_t *value;
+	uint16_t *idx;
+};
+
+struct eaddr_index {
+	struct emelf *e;
+	struct eaddr_list abs;
+	struct eaddr_list rel;
+};
+
+struct eaddr_index * eaddr_create(struct emelf *e);
+void eaddr_destroy(struct eaddr_index *ai);
+
+#endif
+
+// vim: tabstop=4 autoindent
@@ -18,24 +18,40 @@
 #ifndef DH_H
 #define DH_H
 
-struct edh_elem {
-	char *name;
-	struct emelf_symbol *s;
-	struct edh_elem *next;
+#include <inttypes.h>
+
+struct emelf;
+struct emelf_hash_slot;
+struct emelf_hash_stats;
+
+// Open-addressing (linear probing) symbol hash.
+// Slots keep full hash and symbol index, names are looked up
+// in the owning object's symbol_names.
+
+struct edh_slot {
+	uint32_t hash;
+	uint32_t idx; // symbol index + 1, 0 = empty slot
 };
 
 struct edh_table {
-	int size;
-	struct edh_elem **slots;
+	struct emelf *e;
+	unsigned size; // always power of 2
+	unsigned count;
+	struct edh_slot *slots;
 };
 
-struct edh_table * edh_create(int size);
-unsigned edh_hash(struct edh_table *dh, char *name);
-struct emelf_symbol * edh_get(struct edh_table *dh, char *name);
-struct emelf_symbol * edh_add(struct edh_table *dh, char *name, struct emelf_symbol *s);
-int edh_delete(struct edh_table *dh, char *name);
+struct edh_table * edh_create(struct emelf *e, unsigned count);
+unsigned edh_hash(const char *name);
+int edh_get(struct edh_table *dh, const char *name);
+int edh_lookup(struct edh_table *dh, const char *name, unsigned hash);
+int edh_insert(struct edh_table *dh, int idx, unsigned hash);
+int edh_add(struct edh_table *dh, int idx);
+int edh_reserve(struct edh_table *dh, unsigned count);
+int edh_delete(struct edh_table *dh, const char *name);
 void edh_destroy(struct edh_table *dh);
-void edh_dump_stats(struct edh_table *dh);
+struct edh_table * edh_import(struct emelf *e, struct edh_slot *slots, const struct emelf_hash_slot *hs, unsigned size);
+void edh_export(struct edh_table *dh, struct emelf_hash_slot *hs, unsigned start, unsigned count);
+void edh_stats(struct edh_table *dh, struct emelf_hash_stats *hs);
 
 #endif
 
@@ -19,6 +19,7 @@
 #define EMELF_H
 
 #include <stdio.h>
+#include <stddef.h>
 #include <inttypes.h>
 
 #ifdef __cplusplus
@@ -34,16 +35,32 @@ extern "C" {
 #define EMELF_MAGIC "\376EMELF"
 #define EMELF_MAGIC_LEN 6
 
-#define EMELF_VER 0
+// Version 0 stores section offsets and sizes as 16-bit words.
+// Version 1 stores them as 32-bit hi/lo word pairs and starts sections
+// (and the section list) at EMELF_SEC_ALIGN-aligned offsets.
+#define EMELF_VER 1
+#define EMELF_SEC_ALIGN 16
+
+#define EMELF_AR_MAGIC "\376EMARC"
+#define EMELF_AR_VER 0
+#define EMELF_AR_ALIGN 16
 
 #define SIZE_EMELF sizeof(struct emelf)
 #define SIZE_WORD sizeof(uint16_t)
 #define SIZE_CHAR sizeof(char)
 #define SIZE_HEADER sizeof(struct emelf_header)
 #define SIZE_SECTION sizeof(struct emelf_section)
+#define SIZE_SECTION_V0 sizeof(struct emelf_section_v0)
+#define SIZE_SECTION_V1 sizeof(struct emelf_section_v1)
 #define SIZE_SYMBOL sizeof(struct emelf_symbol)
 #define SIZE_RELOC sizeof(struct emelf_reloc)
+#define SIZE_HASH_SLOT sizeof(struct emelf_hash_slot)
+#define SIZE_AR_HEADER sizeof(struct emelf_ar_header)
+#define SIZE_AR_MEMBER sizeof(struct emelf_ar_member)
+#define SIZE_AR_SYMBOL sizeof(struct emelf_ar_symbol)
 
+// Last error of the calling thread is returned by emelf_error().
+// emelf_errno holds the last error in any thread and is kept for compatibility.
 extern int emelf_errno;
 
 enum emelf_errors {
@@ -59,6 +76,9 @@ enum emelf_errors {
 	EMELF_E_ABI,
 	EMELF_E_TYPE,
 	EMELF_E_CPU,
+	EMELF_E_RDONLY,
+	EMELF_E_UNDEF,
+	EMELF_E_DUPSYM,
 };
 
 enum emelf_types {
@@ -72,6 +92,8 @@ enum emelf_types {
 enum emelf_flags {
 	EMELF_FLAG_NONE		= 0,
 	EMELF_FLAG_ENTRY	= 1 << 0,
+	EMELF_FLAG_IMAGE_RLE	= 1 << 1,	// image stored zero-run encoded (version 1+)
+	EMELF_FLAG_CORE_DELTA	= 1 << 2,	// core holds only memory changed since previous core
 };
 
 enum emelf_cpu_types {
@@ -96,6 +118,10 @@ enum emelf_section_types {
 	EMELF_SEC_SYM_NAMES,
 	EMELF_SEC_DEBUG,
 	EMELF_SEC_IDENT,
+	EMELF_SEC_SYM_HASH,
+	EMELF_SEC_SEGMENT,
+	EMELF_SEC_REGS,
+	EMELF_SEC_MAX
 };
 
 enum emelf_symbol_flags {
@@ -125,12 +151,28 @@ struct emelf_header {
 	uint16_t sec_header_lo;
 };
 
+// section list entry, as used in memory
 struct emelf_section {
+	uint16_t type;
+	uint32_t offset;
+	uint32_t size;
+};
+
+// section list entries, as stored in files
+struct emelf_section_v0 {
 	uint16_t type;
 	uint16_t offset;
 	uint16_t size;
 };
 
+struct emelf_section_v1 {
+	uint16_t type;
+	uint16_t offset_hi;
+	uint16_t offset_lo;
+	uint16_t size_hi;
+	uint16_t size_lo;
+};
+
 struct emelf_symbol {
 	uint16_t value;
 	uint16_t flags;
@@ -143,6 +185,102 @@ struct emelf_reloc {
 	uint16_t sym_idx;
 };
 
+// Memory segment of a core: words of memory segment 'id' starting at 'addr'.
+// Stored in EMELF_SEC_SEGMENT as: id, addr hi, addr lo, data words.
+// Memory not stored in any segment is zero (or, in EMELF_FLAG_CORE_DELTA
+// cores, unchanged since the previous core).
+struct emelf_segment {
+	uint16_t id;
+	uint32_t addr;
+	uint32_t size;
+	uint16_t *data;
+};
+
+#define EMELF_SEGMENT_HDR 3
+
+// Symbol definition for emelf_symbols_add()
+struct emelf_symbol_def {
+	const char *name;
+	unsigned flags;
+	uint16_t value;
+};
+
+// Symbol hash index slot, as stored in EMELF_SEC_SYM_HASH.
+// Section holds a power-of-2 number of slots. Symbols are placed
+// with linear probing starting at (32-bit FNV-1a of name) & (slots-1).
+struct emelf_hash_slot {
+	uint16_t hash_hi;
+	uint16_t hash_lo;
+	uint16_t idx;		// symbol index + 1, 0 = empty slot
+};
+
+// Archive of EMELF objects. Header is followed by member list,
+// symbol directory (sorted by name, for binary search) and names.
+// Member objects start at EMELF_AR_ALIGN-aligned offsets.
+// 32-bit values are stored as hi/lo word pairs.
+struct emelf_ar_header {
+	char magic[6];
+	uint16_t version;
+	uint16_t member_count;
+	uint16_t symbol_count_hi;
+	uint16_t symbol_count_lo;
+	uint16_t names_size_hi;
+	uint16_t names_size_lo;
+};
+
+struct emelf_ar_member {
+	uint16_t offset_hi;
+	uint16_t offset_lo;
+	uint16_t size_hi;
+	uint16_t size_lo;
+	uint16_t name_hi;
+	uint16_t name_lo;
+};
+
+struct emelf_ar_symbol {
+	uint16_t name_hi;
+	uint16_t name_lo;
+	uint16_t member;
+};
+
+// Statistics of an object's section I/O (or of all objects).
+// Read and write times include byte swapping, which is also counted
+// separately.
+enum emelf_stat_ops {
+	EMELF_STAT_READ,
+	EMELF_STAT_WRITE,
+	EMELF_STAT_SWAP,
+	EMELF_STAT_OP_MAX
+};
+
+struct emelf_op_stats {
+	unsigned long long count;
+	unsigned long long bytes;
+	unsigned long long ns;
+};
+
+struct emelf_stats {
+	unsigned long long allocs;		// allocations and reallocations of object storage
+	unsigned long long frees;
+	unsigned long long alloc_bytes;
+	struct emelf_op_stats sec[EMELF_SEC_MAX][EMELF_STAT_OP_MAX];
+};
+
+// Symbol hash index statistics
+struct emelf_hash_stats {
+	unsigned slots;
+	unsigned count;
+	unsigned displaced;				// symbols not in their home slot
+	unsigned max_probes;
+	double avg_probes;
+};
+
+// Object summary returned by emelf_probe()
+struct emelf_info {
+	struct emelf_header eh;
+	unsigned sec_size[EMELF_SEC_MAX]; // number of elements in sections of each type
+};
+
 struct emelf {
 	struct emelf_header eh;
 
@@ -150,7 +288,8 @@ struct emelf {
 	int section_slots;
 
 	unsigned amax;
-	uint16_t image[IMAGE_MAX];
+	uint16_t *image;
+	unsigned image_slots;
 	unsigned image_size;
 
 	struct emelf_reloc *reloc;
@@ -158,15 +297,85 @@ struct emelf {
 	int reloc_count;
 
 	struct edh_table *hsymbol;
+	struct eaddr_index *haddr;
 	struct emelf_symbol *symbol;
 	char *symbol_names;
 	int symbol_slots;
 	int symbol_count;
 	int symbol_names_space;
 	int symbol_names_len;
+	int symbol_names_packed; // symbol count when names were last packed
+
+	struct emelf_segment *segment;
+	int segment_slots;
+	int segment_count;
+	uint16_t *regs;
+	unsigned reg_count;
+
+	void *map;
+	size_t map_size;
+
+	const struct emelf_io *lazy_io;
+	void *lazy_ctx;
+	unsigned lazy_pending; // bitmask of (1 << EMELF_SEC_*) not loaded yet
+
+	const struct emelf_allocator *alloc;
+	struct emelf_stats *stats;
 };
 
+// I/O backend: read/write return number of bytes transferred,
+// seek positions at absolute offset and returns 0 on success, -1 on error
+struct emelf_io {
+	size_t (*read)(void *ctx, void *buf, size_t len);
+	size_t (*write)(void *ctx, const void *buf, size_t len);
+	int (*seek)(void *ctx, long offset);
+};
+
+// memory buffer context for emelf_io_mem
+struct emelf_membuf {
+	void *buf;
+	size_t size;
+	size_t pos;
+};
+
+extern const struct emelf_io emelf_io_stdio;	// ctx: FILE *
+extern const struct emelf_io emelf_io_mem;		// ctx: struct emelf_membuf *
+
+// Memory allocator used for all of an object's storage.
+// realloc and free get the current size of the block.
+struct emelf_allocator {
+	void * (*alloc)(void *ctx, size_t size);
+	void * (*realloc)(void *ctx, void *ptr, size_t old_size, size_t size);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+};
+
+extern const struct emelf_allocator emelf_allocator_malloc;
+
+// Arena: bump allocator releasing everything at once with emelf_arena_reset()
+// or emelf_arena_destroy(). Objects allocated from an arena don't need
+// emelf_destroy(). Arena is not thread-safe.
+#define EMELF_ARENA_CHUNK (256 * 1024)
+
+struct emelf_arena;
+
+struct emelf_arena * emelf_arena_create(size_t chunk_size);
+const struct emelf_allocator * emelf_arena_allocator(struct emelf_arena *ar);
+void emelf_arena_reset(struct emelf_arena *ar);
+void emelf_arena_destroy(struct emelf_arena *ar);
+
+int emelf_error(void);
+
+// Statistics are collected for objects created, loaded or mapped while
+// enabled (off by default), per object and process-wide.
+void emelf_stats_enable(int on);
+const struct emelf_stats * emelf_stats_get(struct emelf *e);
+void emelf_stats_global(struct emelf_stats *s);
+void emelf_stats_reset(void);
+int emelf_hash_stats(struct emelf *e, struct emelf_hash_stats *hs);
+
 struct emelf * emelf_create(unsigned type, unsigned cpu, unsigned abi);
+struct emelf * emelf_create_a(unsigned type, unsigned cpu, unsigned abi, const struct emelf_allocator *a);
 void emelf_destroy(struct emelf *e);
 
 int emelf_section_add(struct emelf *e, int type);
@@ -175,14 +384,132 @@ int emelf_entry_set(struct emelf *e, unsigned a);
 int emelf_image_append(struct emelf *e, uint16_t *i, unsigned ilen);
 
 int emelf_reloc_add(struct emelf *e, unsigned addr, unsigned flags, int sym_idx);
+int emelf_segment_add(struct emelf *e, unsigned id, unsigned addr, const uint16_t *data, unsigned size);
+int emelf_regs_set(struct emelf *e, const uint16_t *regs, unsigned count);
 int emelf_symbol_add(struct emelf *e, unsigned flags, char *sym_name, uint16_t value);
+// Add many symbols at once, with storage and hash index sized once.
+// Index of each symbol (or of the one with the same name defined before)
+// is stored in idx, if not NULL. On error, symbols before the failing
+// one stay added.
+int emelf_symbols_add(struct emelf *e, const struct emelf_symbol_def *sym, int count, int *idx);
 struct emelf_symbol * emelf_symbol_get(struct emelf *e, char *sym_name);
+// Address lookups consider defined symbols only, relative ones at 'base'.
+// emelf_symbol_at() returns index of the symbol with the highest address
+// not above 'addr' (-1 if none), emelf_symbols_range() stores up to 'max'
+// indexes of symbols in [start, end) in address order and returns their
+// total count. Index is built on first lookup (or with emelf_addr_index()),
+// after that lookups are lock-free and may run in many threads at once.
+int emelf_addr_index(struct emelf *e);
+int emelf_symbol_at(struct emelf *e, unsigned addr, unsigned base);
+int emelf_symbols_range(struct emelf *e, unsigned start, unsigned end, unsigned base, int *idx, int max);
 
 struct emelf * emelf_load(FILE *f);
+struct emelf * emelf_load_io(const struct emelf_io *io, void *ctx);
+struct emelf * emelf_load_io_a(const struct emelf_io *io, void *ctx, const struct emelf_allocator *a);
+struct emelf * emelf_load_mem(const void *buf, size_t size);
+
+// Lazy loading: only header, section list and image are read up front,
+// relocations and symbols are read on first use (or with emelf_section_load()).
+// I/O context has to stay valid until all sections are loaded.
+// Loading on first use modifies the object, so it is not thread-safe.
+struct emelf * emelf_load_lazy(const struct emelf_io *io, void *ctx, const struct emelf_allocator *a);
+int emelf_section_load(struct emelf *e, int type);
+int emelf_sections_load(struct emelf *e);
+struct emelf_reloc * emelf_relocs(struct emelf *e);
+struct emelf_symbol * emelf_symbols(struct emelf *e);
+char * emelf_symbol_names(struct emelf *e);
+
+struct emelf * emelf_map(const char *path);
+// Mapped if possible, loaded otherwise (pipes, devices, ...)
+struct emelf * emelf_open(const char *path);
+int emelf_probe(FILE *f, struct emelf_info *info);
+int emelf_probe_io(const struct emelf_io *io, void *ctx, struct emelf_info *info);
+// Objects are written in their eh.version. Version 0 objects are written
+// without the symbol hash section and with names table as is, so an
+// unmodified one comes out unchanged. Ones that outgrew 16-bit offsets, or
+// have sections or flags added after version 0, fail with EMELF_E_VERSION
+// (set eh.version to EMELF_VER).
+// Symbol names of newer objects that are not mapped get packed before
+// writing (names ending with another name share its storage), which moves
+// them and invalidates pointers into emelf_symbol_names().
+// Section offsets are laid out from the start of the object, so
+// emelf_write() rewinds the file first, and emelf_write_io() expects
+// the I/O context to be at the position readers will seek to as 0.
 int emelf_write(struct emelf *e, FILE *f);
+int emelf_write_io(struct emelf *e, const struct emelf_io *io, void *ctx);
+int emelf_write_mem(struct emelf *e, void **buf, size_t *size);
 
 int emelf_has_entry(struct emelf *e);
 
+// Core snapshots of emulator memory. Memory is tracked in pages of
+// EMELF_CORE_PAGE words, only non-zero pages (or, for delta snapshots,
+// pages changed since the previous snapshot) are stored, adjacent pages
+// in one segment. If memory layout differs from the previous snapshot,
+// full snapshot is made. Snapshots are EMELF_CORE objects to be written
+// with emelf_write() and destroyed with emelf_destroy().
+#define EMELF_CORE_PAGE 256
+
+struct emelf_core_mem {
+	unsigned id;
+	const uint16_t *mem;
+	unsigned size;
+};
+
+struct emelf_core;
+
+struct emelf_core * emelf_core_create(unsigned cpu, unsigned abi);
+struct emelf * emelf_core_snapshot(struct emelf_core *c, const struct emelf_core_mem *mem, int count, const uint16_t *regs, unsigned reg_count, int delta);
+void emelf_core_destroy(struct emelf_core *c);
+
+// Link relocatable objects into an executable. Images are placed one after
+// another starting at address 0, entry point is taken from the first object
+// that has one. Unresolved or duplicate symbol name is returned in sym_name
+// (if not NULL) together with EMELF_E_UNDEF/EMELF_E_DUPSYM.
+struct emelf * emelf_link(struct emelf **obj, int count, char **sym_name);
+
+// Relocate image of a relocatable object in place, for loading at base.
+// All symbols have to be defined in the object. Large relocation tables
+// are applied in parallel by up to 'threads' threads. With 0 up to CPU
+// count threads are used, if earlier relocations showed it's faster.
+// Relocations are kept, so the image can be relocated only once.
+int emelf_relocate(struct emelf *e, unsigned base, int threads);
+
+// Rebase plan: relocations of a relocatable object (with all symbols
+// defined) compiled once, for producing relocated images at any base.
+// emelf_rebase_apply() writes emelf_rebase_size() words to image.
+struct emelf_rebase;
+
+struct emelf_rebase * emelf_rebase_compile(struct emelf *e);
+int emelf_rebase_apply(const struct emelf_rebase *rb, unsigned base, uint16_t *image);
+unsigned emelf_rebase_size(const struct emelf_rebase *rb);
+void emelf_rebase_destroy(struct emelf_rebase *rb);
+
+// Strip relocations and symbols nothing needs. Relocations against symbols
+// defined in the object are resolved into the image (against relative
+// symbols they become base relocations, unless negative), relocations that
+// do nothing are dropped. Then symbols no relocation refers to are dropped,
+// except for global symbols of relocatable objects. Symbol indexes in
+// relocations are updated. Mapped objects can't be stripped.
+int emelf_strip(struct emelf *e);
+
+// Archives. Members get their GLOBAL symbols indexed in the directory,
+// a symbol can be defined by one member only. Opened archives are mapped,
+// members are loaded only when asked for.
+struct emelf_ar;
+
+int emelf_ar_write(FILE *f, struct emelf **obj, char **names, int count);
+int emelf_ar_write_io(const struct emelf_io *io, void *ctx, struct emelf **obj, char **names, int count);
+struct emelf_ar * emelf_ar_open(const char *path);
+void emelf_ar_close(struct emelf_ar *ar);
+int emelf_ar_member_count(struct emelf_ar *ar);
+const char * emelf_ar_member_name(struct emelf_ar *ar, int idx);
+const void * emelf_ar_member_data(struct emelf_ar *ar, int idx, size_t *size);
+struct emelf * emelf_ar_member_load(struct emelf_ar *ar, int idx);
+unsigned emelf_ar_symbol_count(struct emelf_ar *ar);
+const char * emelf_ar_symbol_name(struct emelf_ar *ar, unsigned idx);
+int emelf_ar_symbol_member(struct emelf_ar *ar, unsigned idx);
+int emelf_ar_find(struct emelf_ar *ar, const char *sym_name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,57 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef EREL_H
+#define EREL_H
+
+#include <inttypes.h>
+
+struct emelf_reloc;
+
+// Relocation engine. Symbol values are resolved by the caller:
+// value[i] is the value of symbol i, addr[i] is set if it is an address
+// (doubled for byte relocations). Both arrays need at least one element,
+// even if there are no symbols.
+
+// relocations are sorted into batches covering 1<<EREL_BATCH_SHIFT words
+#define EREL_BATCH_SHIFT 12
+// below this number of relocations they are applied in place, single-threaded
+#define EREL_PARALLEL_MIN 16384
+
+// erel_apply() with threads <= 0 uses up to CPU count threads, but only
+// after the parallel path has been measured to be faster than the
+// sequential one on earlier tables of this process.
+
+struct erel {
+	uint16_t *image;
+	unsigned image_size;
+	unsigned base;
+	const struct emelf_reloc *reloc;
+	unsigned count;
+	const uint16_t *value;
+	const char *addr;
+	unsigned symbol_count;
+};
+
+int erel_check(const struct erel *r);
+void erel_apply_seq(const struct erel *r);
+int erel_apply(const struct erel *r, int threads);
+
+#endif
+
+// vim: tabstop=4 autoindent
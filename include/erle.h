@@ -0,0 +1,48 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef ERLE_H
+#define ERLE_H
+
+#include <inttypes.h>
+
+// Zero-run image encoding. Encoded image is a sequence of records:
+//   zero count, literal count, literal words...
+// Zero runs shorter than ERLE_MIN_ZEROS are stored as literals and
+// a record holds at most 65535 literals, so encoded image is at most
+// 2 words longer per started 65532 words of the image (4 words longer
+// for a full 64K-word image with no zero runs).
+#define ERLE_MIN_ZEROS 4
+
+struct erle_dec {
+	uint16_t *dst;
+	unsigned size;
+	unsigned pos;
+	unsigned left;
+	int state;
+};
+
+unsigned erle_record(const uint16_t *src, unsigned len, unsigned *zeros, unsigned *literals);
+unsigned erle_encode(const uint16_t *src, unsigned len, uint16_t *dst);
+void erle_dec_init(struct erle_dec *d, uint16_t *dst, unsigned size);
+int erle_decode(struct erle_dec *d, const uint16_t *src, unsigned len);
+int erle_dec_done(struct erle_dec *d);
+
+#endif
+
+// vim: tabstop=4 autoindent
@@ -0,0 +1,40 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef ESTATS_H
+#define ESTATS_H
+
+#include <inttypes.h>
+
+struct emelf;
+struct emelf_allocator;
+
+// set with emelf_stats_enable(), read without synchronization on hot paths
+extern int estats_on;
+
+// time spent swapping bytes by the current thread, since estats_start()
+extern __thread uint64_t estats_swap_ns;
+
+uint64_t estats_now(void);
+void estats_attach(struct emelf *e);
+const struct emelf_allocator * estats_detach(struct emelf *e);
+uint64_t estats_start(void);
+void estats_section(struct emelf *e, int type, int op, uint64_t bytes, uint64_t start);
+
+#endif
+
+// vim: tabstop=4 autoindent
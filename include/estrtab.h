@@ -0,0 +1,30 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef ESTRTAB_H
+#define ESTRTAB_H
+
+struct emelf;
+
+// Symbol names table packing: names that are a suffix of another name
+// (or equal to it) are not stored on their own, but point into the tail
+// of the longer one. Only the table as a whole is padded to 16 bits.
+int estrtab_pack(struct emelf *e);
+
+#endif
+
+// vim: tabstop=4 autoindent
@@ -0,0 +1,39 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef ESWAP_H
+#define ESWAP_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+void eswap(uint16_t *t, size_t len);
+void eswap_copy(uint16_t *dst, const uint16_t *src, size_t len);
+
+// Kernels the CPU can run, from the slowest to the one eswap() uses.
+// All of them handle dst == src. For benchmarks.
+struct eswap_kernel {
+	const char *name;
+	void (*copy)(uint16_t *dst, const uint16_t *src, size_t len);
+};
+
+const struct eswap_kernel * eswap_kernels(int *count);
+
+#endif
+
+// vim: tabstop=4 autoindent
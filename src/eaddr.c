@@ -0,0 +1,235 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "emelf.h"
+#include "eerr.h"
+#include "eaddr.h"
+#include "ealloc.h"
+
+// -----------------------------------------------------------------------
+static int eaddr_key_cmp(const void *a, const void *b)
+{
+	uint32_t ka = *(const uint32_t*) a;
+	uint32_t kb = *(const uint32_t*) b;
+
+	return (ka > kb) - (ka < kb);
+}
+
+// -----------------------------------------------------------------------
+static int eaddr_list_build(struct eaddr_index *ai, struct eaddr_list *l, int relative)
+{
+	int i;
+	unsigned count = 0;
+	struct emelf *e = ai->e;
+
+	for (i=0 ; i<e->symbol_count ; i++) {
+		unsigned flags = e->symbol[i].flags;
+		count += (flags & EMELF_SYM_GLOBAL) && (!(flags & EMELF_SYM_RELATIVE) == !relative);
+	}
+	if (!count) {
+		return EMELF_E_OK;
+	}
+
+	// sort (value, index) pairs packed in one key, then split them
+	uint32_t *key = malloc(count * sizeof(uint32_t));
+	l->value = ea_alloc(e->alloc, count * sizeof(uint16_t));
+	l->idx = ea_alloc(e->alloc, count * sizeof(uint16_t));
+	l->count = count;
+	if (!key || !l->value || !l->idx) {
+		free(key);
+		return EMELF_E_ALLOC;
+	}
+
+	count = 0;
+	for (i=0 ; i<e->symbol_count ; i++) {
+		unsigned flags = e->symbol[i].flags;
+		if ((flags & EMELF_SYM_GLOBAL) && (!(flags & EMELF_SYM_RELATIVE) == !relative)) {
+			key[count++] = ((uint32_t) e->symbol[i].value << 16) | i;
+		}
+	}
+	qsort(key, count, sizeof(uint32_t), eaddr_key_cmp);
+
+	for (i=0 ; i<count ; i++) {
+		l->value[i] = key[i] >> 16;
+		l->idx[i] = key[i] & 65535;
+	}
+	free(key);
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+struct eaddr_index * eaddr_create(struct emelf *e)
+{
+	struct eaddr_index *ai = ea_zalloc(e->alloc, sizeof(struct eaddr_index));
+	if (!ai) {
+		return NULL;
+	}
+	ai->e = e;
+
+	if ((eaddr_list_build(ai, &ai->abs, 0) != EMELF_E_OK) || (eaddr_list_build(ai, &ai->rel, 1) != EMELF_E_OK)) {
+		eaddr_destroy(ai);
+		return NULL;
+	}
+
+	return ai;
+}
+
+// -----------------------------------------------------------------------
+void eaddr_destroy(struct eaddr_index *ai)
+{
+	if (!ai) {
+		return;
+	}
+
+	const struct emelf_allocator *a = ai->e->alloc;
+
+	ea_free(a, ai->abs.value, ai->abs.count * sizeof(uint16_t));
+	ea_free(a, ai->abs.idx, ai->abs.count * sizeof(uint16_t));
+	ea_free(a, ai->rel.value, ai->rel.count * sizeof(uint16_t));
+	ea_free(a, ai->rel.idx, ai->rel.count * sizeof(uint16_t));
+	ea_free(a, ai, sizeof(struct eaddr_index));
+}
+
+// -----------------------------------------------------------------------
+static unsigned eaddr_count_below(const uint16_t *v, unsigned n, unsigned key)
+{
+	const uint16_t *b = v;
+
+	if (!n) {
+		return 0;
+	}
+
+	// halving without data-dependent branches, compiles to cmov
+	while (n > 1) {
+		unsigned half = n / 2;
+		b = (b[half] < key) ? b + half : b;
+		n -= half;
+	}
+
+	return (b - v) + (*b < key);
+}
+
+// -----------------------------------------------------------------------
+static inline unsigned eaddr_rel_key(unsigned addr, unsigned base)
+{
+	// relative symbol values are 16-bit, keys cover them all
+	if (addr < base) {
+		return 0;
+	}
+	addr -= base;
+
+	return addr > 65536 ? 65536 : addr;
+}
+
+// -----------------------------------------------------------------------
+int emelf_addr_index(struct emelf *e)
+{
+	assert(e);
+
+	int res;
+	struct eaddr_index *expected = NULL;
+
+	if (__atomic_load_n(&e->haddr, __ATOMIC_ACQUIRE)) {
+		return EMELF_E_OK;
+	}
+
+	res = emelf_section_load(e, EMELF_SEC_SYM);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	struct eaddr_index *ai = eaddr_create(e);
+	if (!ai) {
+		return EMELF_E_ALLOC;
+	}
+
+	// threads doing first lookups on a shared object may race here,
+	// only one index gets published
+	if (!__atomic_compare_exchange_n(&e->haddr, &expected, ai, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		eaddr_destroy(ai);
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static struct eaddr_index * eaddr_get(struct emelf *e)
+{
+	int res = emelf_addr_index(e);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		return NULL;
+	}
+
+	return __atomic_load_n(&e->haddr, __ATOMIC_ACQUIRE);
+}
+
+// -----------------------------------------------------------------------
+int emelf_symbol_at(struct emelf *e, unsigned addr, unsigned base)
+{
+	struct eaddr_index *ai = eaddr_get(e);
+	if (!ai) {
+		return -1;
+	}
+
+	// last symbol at or below addr in each list, the higher one wins
+	unsigned na = eaddr_count_below(ai->abs.value, ai->abs.count, addr + 1);
+	unsigned nr = eaddr_count_below(ai->rel.value, ai->rel.count, eaddr_rel_key(addr + 1, base));
+
+	long va = na ? (long) ai->abs.value[na-1] : -1;
+	long vr = nr ? (long) ai->rel.value[nr-1] + base : -1;
+
+	if ((vr < 0) && (va < 0)) {
+		return -1;
+	}
+
+	return vr >= va ? ai->rel.idx[nr-1] : ai->abs.idx[na-1];
+}
+
+// -----------------------------------------------------------------------
+int emelf_symbols_range(struct emelf *e, unsigned start, unsigned end, unsigned base, int *idx, int max)
+{
+	struct eaddr_index *ai = eaddr_get(e);
+	if (!ai) {
+		return -1;
+	}
+
+	if (start >= end) {
+		return 0;
+	}
+
+	unsigned a = eaddr_count_below(ai->abs.value, ai->abs.count, start);
+	unsigned a_end = eaddr_count_below(ai->abs.value, ai->abs.count, end);
+	unsigned r = eaddr_count_below(ai->rel.value, ai->rel.count, eaddr_rel_key(start, base));
+	unsigned r_end = eaddr_count_below(ai->rel.value, ai->rel.count, eaddr_rel_key(end, base));
+	int count = (a_end - a) + (r_end - r);
+
+	// merge both lists in address order
+	int pos = 0;
+	while ((pos < max) && ((a < a_end) || (r < r_end))) {
+		int take_rel = (r < r_end) && ((a >= a_end) || ((unsigned long) ai->rel.value[r] + base <= ai->abs.value[a]));
+		idx[pos++] = take_rel ? ai->rel.idx[r++] : ai->abs.idx[a++];
+	}
+
+	return count;
+}
+
+// vim: tabstop=4 autoindent
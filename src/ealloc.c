@@ -0,0 +1,240 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "emelf.h"
+#include "ealloc.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	size_t last;
+};
+
+#define ARENA_HDR ARENA_ROUND(sizeof(struct arena_chunk))
+
+struct emelf_arena {
+	struct emelf_allocator allocator;
+	struct arena_chunk *chunk;
+	size_t chunk_size;
+};
+
+// -----------------------------------------------------------------------
+static void * malloc_alloc(void *ctx, size_t size)
+{
+	return malloc(size);
+}
+
+// -----------------------------------------------------------------------
+static void * malloc_realloc(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+	return realloc(ptr, size);
+}
+
+// -----------------------------------------------------------------------
+static void malloc_free(void *ctx, void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+const struct emelf_allocator emelf_allocator_malloc = {
+	.alloc = malloc_alloc,
+	.realloc = malloc_realloc,
+	.free = malloc_free,
+	.ctx = NULL,
+};
+
+// -----------------------------------------------------------------------
+void * ea_alloc(const struct emelf_allocator *a, size_t size)
+{
+	return a->alloc(a->ctx, size);
+}
+
+// -----------------------------------------------------------------------
+void * ea_zalloc(const struct emelf_allocator *a, size_t size)
+{
+	void *ptr = a->alloc(a->ctx, size);
+	if (ptr) {
+		memset(ptr, 0, size);
+	}
+
+	return ptr;
+}
+
+// -----------------------------------------------------------------------
+void * ea_realloc(const struct emelf_allocator *a, void *ptr, size_t old_size, size_t size)
+{
+	if (!ptr) {
+		return a->alloc(a->ctx, size);
+	}
+
+	return a->realloc(a->ctx, ptr, old_size, size);
+}
+
+// -----------------------------------------------------------------------
+void ea_free(const struct emelf_allocator *a, void *ptr, size_t size)
+{
+	if (ptr) {
+		a->free(a->ctx, ptr, size);
+	}
+}
+
+// -----------------------------------------------------------------------
+static struct arena_chunk * arena_chunk_new(struct emelf_arena *ar, size_t size)
+{
+	if (size < ar->chunk_size) {
+		size = ar->chunk_size;
+	}
+
+	struct arena_chunk *c = malloc(ARENA_HDR + size);
+	if (!c) {
+		return NULL;
+	}
+
+	c->size = size;
+	c->used = 0;
+	c->last = SIZE_MAX;
+	c->next = ar->chunk;
+	ar->chunk = c;
+
+	return c;
+}
+
+// -----------------------------------------------------------------------
+static void * arena_alloc(void *ctx, size_t size)
+{
+	struct emelf_arena *ar = ctx;
+	struct arena_chunk *c = ar->chunk;
+
+	size = ARENA_ROUND(size ? size : 1);
+
+	if (!c || (c->size - c->used < size)) {
+		c = arena_chunk_new(ar, size);
+		if (!c) {
+			return NULL;
+		}
+	}
+
+	c->last = c->used;
+	c->used += size;
+
+	return (char*) c + ARENA_HDR + c->last;
+}
+
+// -----------------------------------------------------------------------
+static void * arena_realloc(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+	struct emelf_arena *ar = ctx;
+	struct arena_chunk *c = ar->chunk;
+
+	// most recent allocation can grow or shrink in place
+	if (c && (ptr == (char*) c + ARENA_HDR + c->last)) {
+		size_t rsize = ARENA_ROUND(size ? size : 1);
+		if (c->size - c->last >= rsize) {
+			c->used = c->last + rsize;
+			return ptr;
+		}
+	}
+
+	void *nptr = arena_alloc(ctx, size);
+	if (nptr) {
+		memcpy(nptr, ptr, old_size < size ? old_size : size);
+	}
+
+	return nptr;
+}
+
+// -----------------------------------------------------------------------
+static void arena_free(void *ctx, void *ptr, size_t size)
+{
+	struct emelf_arena *ar = ctx;
+	struct arena_chunk *c = ar->chunk;
+
+	// only the most recent allocation is given back, the rest goes with the arena
+	if (c && (ptr == (char*) c + ARENA_HDR + c->last)) {
+		c->used = c->last;
+		c->last = SIZE_MAX;
+	}
+}
+
+// -----------------------------------------------------------------------
+struct emelf_arena * emelf_arena_create(size_t chunk_size)
+{
+	struct emelf_arena *ar = malloc(sizeof(struct emelf_arena));
+	if (!ar) {
+		return NULL;
+	}
+
+	ar->allocator.alloc = arena_alloc;
+	ar->allocator.realloc = arena_realloc;
+	ar->allocator.free = arena_free;
+	ar->allocator.ctx = ar;
+	ar->chunk = NULL;
+	ar->chunk_size = chunk_size ? ARENA_ROUND(chunk_size) : EMELF_ARENA_CHUNK;
+
+	return ar;
+}
+
+// -----------------------------------------------------------------------
+const struct emelf_allocator * emelf_arena_allocator(struct emelf_arena *ar)
+{
+	return &ar->allocator;
+}
+
+// -----------------------------------------------------------------------
+void emelf_arena_reset(struct emelf_arena *ar)
+{
+	struct arena_chunk *c;
+
+	if (!ar || !ar->chunk) return;
+
+	// keep the most recent chunk for reuse
+	while (ar->chunk->next) {
+		c = ar->chunk->next;
+		ar->chunk->next = c->next;
+		free(c);
+	}
+
+	ar->chunk->used = 0;
+	ar->chunk->last = SIZE_MAX;
+}
+
+// -----------------------------------------------------------------------
+void emelf_arena_destroy(struct emelf_arena *ar)
+{
+	struct arena_chunk *c;
+
+	if (!ar) return;
+
+	while (ar->chunk) {
+		c = ar->chunk;
+		ar->chunk = c->next;
+		free(c);
+	}
+
+	free(ar);
+}
+
+// vim: tabstop=4 autoindent
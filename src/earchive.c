@@ -0,0 +1,419 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "emelf.h"
+#include "eerr.h"
+#include "eswap.h"
+
+#define AR_HI(v) ((uint16_t) ((v) >> 16))
+#define AR_LO(v) ((uint16_t) ((v) & 0xffff))
+#define AR_U32(hi, lo) (((uint32_t) (hi) << 16) + (lo))
+#define AR_PAD(v) (((v) + EMELF_AR_ALIGN - 1) & ~(size_t) (EMELF_AR_ALIGN - 1))
+
+struct emelf_ar {
+	void *map;
+	size_t map_size;
+	struct emelf_ar_header h;
+	struct emelf_ar_member *member;
+	struct emelf_ar_symbol *symbol;
+	char *names;
+	unsigned symbol_count;
+	unsigned names_size;
+};
+
+struct ear_sym {
+	const char *name;
+	int member;
+};
+
+// -----------------------------------------------------------------------
+static int ear_sym_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct ear_sym*) a)->name, ((const struct ear_sym*) b)->name);
+}
+
+// -----------------------------------------------------------------------
+static int ear_write_words(const struct emelf_io *io, void *ctx, void *buf, size_t size)
+{
+	eswap(buf, size / SIZE_WORD);
+	return io->write(ctx, buf, size) == size ? 0 : -1;
+}
+
+// -----------------------------------------------------------------------
+static int ear_write_pad(const struct emelf_io *io, void *ctx, size_t len)
+{
+	static const char zero[EMELF_AR_ALIGN];
+	return io->write(ctx, zero, len) == len ? 0 : -1;
+}
+
+// -----------------------------------------------------------------------
+int emelf_ar_write_io(const struct emelf_io *io, void *ctx, struct emelf **obj, char **names, int count)
+{
+	int i, j;
+	int res;
+	unsigned symbol_count = 0;
+	size_t names_size = 0;
+	size_t offset;
+	void **data = NULL;
+	size_t *size = NULL;
+	struct ear_sym *sym = NULL;
+	struct emelf_ar_member *member = NULL;
+	struct emelf_ar_symbol *symbol = NULL;
+	struct emelf_ar_header h;
+
+	if ((count <= 0) || (count > 65535)) {
+		return EMELF_E_COUNT;
+	}
+
+	data = calloc(count, sizeof(void*));
+	size = calloc(count, sizeof(size_t));
+	member = calloc(count, SIZE_AR_MEMBER);
+	if (!data || !size || !member) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+
+	// serialize members, collect their global symbols
+	for (i=0 ; i<count ; i++) {
+		res = emelf_write_mem(obj[i], data + i, size + i);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+		for (j=0 ; j<obj[i]->symbol_count ; j++) {
+			if (obj[i]->symbol[j].flags & EMELF_SYM_GLOBAL) {
+				symbol_count++;
+			}
+		}
+	}
+
+	sym = malloc((symbol_count + 1) * sizeof(struct ear_sym));
+	symbol = malloc((symbol_count + 1) * SIZE_AR_SYMBOL);
+	if (!sym || !symbol) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+	symbol_count = 0;
+	for (i=0 ; i<count ; i++) {
+		for (j=0 ; j<obj[i]->symbol_count ; j++) {
+			if (obj[i]->symbol[j].flags & EMELF_SYM_GLOBAL) {
+				sym[symbol_count].name = obj[i]->symbol_names + obj[i]->symbol[j].offset;
+				sym[symbol_count].member = i;
+				symbol_count++;
+			}
+		}
+	}
+	qsort(sym, symbol_count, sizeof(struct ear_sym), ear_sym_cmp);
+
+	// names: members first, then symbols
+	for (i=0 ; i<count ; i++) {
+		member[i].name_hi = AR_HI(names_size);
+		member[i].name_lo = AR_LO(names_size);
+		names_size += strlen(names[i]) + 1;
+	}
+	for (i=0 ; i<symbol_count ; i++) {
+		if ((i > 0) && !strcmp(sym[i].name, sym[i-1].name)) {
+			res = EMELF_E_DUPSYM;
+			goto cleanup;
+		}
+		symbol[i].name_hi = AR_HI(names_size);
+		symbol[i].name_lo = AR_LO(names_size);
+		symbol[i].member = sym[i].member;
+		names_size += strlen(sym[i].name) + 1;
+	}
+
+	// member layout
+	offset = AR_PAD(SIZE_AR_HEADER + count * SIZE_AR_MEMBER + symbol_count * SIZE_AR_SYMBOL + names_size);
+	for (i=0 ; i<count ; i++) {
+		if ((offset > UINT32_MAX) || (size[i] > UINT32_MAX)) {
+			res = EMELF_E_COUNT;
+			goto cleanup;
+		}
+		member[i].offset_hi = AR_HI(offset);
+		member[i].offset_lo = AR_LO(offset);
+		member[i].size_hi = AR_HI(size[i]);
+		member[i].size_lo = AR_LO(size[i]);
+		offset = AR_PAD(offset + size[i]);
+	}
+
+	memset(&h, 0, SIZE_AR_HEADER);
+	memcpy(h.magic, EMELF_AR_MAGIC, EMELF_MAGIC_LEN);
+	h.version = EMELF_AR_VER;
+	h.member_count = count;
+	h.symbol_count_hi = AR_HI(symbol_count);
+	h.symbol_count_lo = AR_LO(symbol_count);
+	h.names_size_hi = AR_HI(names_size);
+	h.names_size_lo = AR_LO(names_size);
+
+	res = EMELF_E_FWRITE;
+	if ((io->write(ctx, h.magic, EMELF_MAGIC_LEN) != EMELF_MAGIC_LEN)
+	|| ear_write_words(io, ctx, (char*) &h + EMELF_MAGIC_LEN, SIZE_AR_HEADER - EMELF_MAGIC_LEN)
+	|| ear_write_words(io, ctx, member, count * SIZE_AR_MEMBER)
+	|| ear_write_words(io, ctx, symbol, symbol_count * SIZE_AR_SYMBOL)) {
+		goto cleanup;
+	}
+	for (i=0 ; i<count ; i++) {
+		size_t len = strlen(names[i]) + 1;
+		if (io->write(ctx, names[i], len) != len) {
+			goto cleanup;
+		}
+	}
+	for (i=0 ; i<symbol_count ; i++) {
+		size_t len = strlen(sym[i].name) + 1;
+		if (io->write(ctx, sym[i].name, len) != len) {
+			goto cleanup;
+		}
+	}
+	offset = SIZE_AR_HEADER + count * SIZE_AR_MEMBER + symbol_count * SIZE_AR_SYMBOL + names_size;
+	for (i=0 ; i<count ; i++) {
+		if (ear_write_pad(io, ctx, AR_PAD(offset) - offset) || (io->write(ctx, data[i], size[i]) != size[i])) {
+			goto cleanup;
+		}
+		offset = AR_PAD(offset) + size[i];
+	}
+
+	res = EMELF_E_OK;
+
+cleanup:
+	if (data) {
+		for (i=0 ; i<count ; i++) {
+			free(data[i]);
+		}
+	}
+	free(data);
+	free(size);
+	free(member);
+	free(sym);
+	free(symbol);
+	return res;
+}
+
+// -----------------------------------------------------------------------
+int emelf_ar_write(FILE *f, struct emelf **obj, char **names, int count)
+{
+	return emelf_ar_write_io(&emelf_io_stdio, f, obj, names, count);
+}
+
+// -----------------------------------------------------------------------
+static int ear_check(struct emelf_ar *ar)
+{
+	unsigned i;
+	size_t tables = (char*) ar->names - (char*) ar->map;
+
+	if (ar->names_size > ar->map_size - tables) {
+		return EMELF_E_SECTION;
+	}
+
+	// terminated last name means all names are terminated
+	if (ar->names_size && ar->names[ar->names_size-1]) {
+		return EMELF_E_SECTION;
+	}
+
+	for (i=0 ; i<ar->h.member_count ; i++) {
+		struct emelf_ar_member *m = ar->member + i;
+		uint32_t offset = AR_U32(m->offset_hi, m->offset_lo);
+		uint32_t size = AR_U32(m->size_hi, m->size_lo);
+		if ((offset & 1) || (offset > ar->map_size) || (size > ar->map_size - offset)) {
+			return EMELF_E_SECTION;
+		}
+		if (AR_U32(m->name_hi, m->name_lo) >= ar->names_size) {
+			return EMELF_E_SECTION;
+		}
+	}
+
+	for (i=0 ; i<ar->symbol_count ; i++) {
+		struct emelf_ar_symbol *s = ar->symbol + i;
+		if ((s->member >= ar->h.member_count) || (AR_U32(s->name_hi, s->name_lo) >= ar->names_size)) {
+			return EMELF_E_SECTION;
+		}
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+struct emelf_ar * emelf_ar_open(const char *path)
+{
+	int res;
+	int fd;
+	struct stat st;
+	struct emelf_ar *ar = NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		emelf_seterr(EMELF_E_FREAD);
+		return NULL;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t) SIZE_AR_HEADER)) {
+		close(fd);
+		emelf_seterr(EMELF_E_FREAD);
+		return NULL;
+	}
+
+	ar = calloc(1, sizeof(struct emelf_ar));
+	if (!ar) {
+		close(fd);
+		emelf_seterr(EMELF_E_ALLOC);
+		return NULL;
+	}
+
+	// tables are decoded in place, members are left as they are
+	ar->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ar->map == MAP_FAILED) {
+		free(ar);
+		emelf_seterr(EMELF_E_FREAD);
+		return NULL;
+	}
+	ar->map_size = st.st_size;
+
+	memcpy(&ar->h, ar->map, SIZE_AR_HEADER);
+	eswap((uint16_t*) ((char*) &ar->h + EMELF_MAGIC_LEN), (SIZE_AR_HEADER - EMELF_MAGIC_LEN) / SIZE_WORD);
+
+	if (memcmp(ar->h.magic, EMELF_AR_MAGIC, EMELF_MAGIC_LEN)) {
+		res = EMELF_E_MAGIC;
+		goto cleanup;
+	}
+	if (ar->h.version != EMELF_AR_VER) {
+		res = EMELF_E_VERSION;
+		goto cleanup;
+	}
+
+	ar->symbol_count = AR_U32(ar->h.symbol_count_hi, ar->h.symbol_count_lo);
+	ar->names_size = AR_U32(ar->h.names_size_hi, ar->h.names_size_lo);
+	if (SIZE_AR_HEADER + ar->h.member_count * SIZE_AR_MEMBER + (uint64_t) ar->symbol_count * SIZE_AR_SYMBOL > ar->map_size) {
+		res = EMELF_E_SECTION;
+		goto cleanup;
+	}
+	ar->member = (struct emelf_ar_member*) ((char*) ar->map + SIZE_AR_HEADER);
+	ar->symbol = (struct emelf_ar_symbol*) (ar->member + ar->h.member_count);
+	ar->names = (char*) (ar->symbol + ar->symbol_count);
+
+	eswap((uint16_t*) ar->member, ar->h.member_count * SIZE_AR_MEMBER / SIZE_WORD);
+	eswap((uint16_t*) ar->symbol, ar->symbol_count * SIZE_AR_SYMBOL / SIZE_WORD);
+
+	res = ear_check(ar);
+	if (res != EMELF_E_OK) {
+		goto cleanup;
+	}
+
+	return ar;
+
+cleanup:
+	emelf_seterr(res);
+	emelf_ar_close(ar);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+void emelf_ar_close(struct emelf_ar *ar)
+{
+	if (!ar) {
+		return;
+	}
+
+	munmap(ar->map, ar->map_size);
+	free(ar);
+}
+
+// -----------------------------------------------------------------------
+int emelf_ar_member_count(struct emelf_ar *ar)
+{
+	return ar->h.member_count;
+}
+
+// -----------------------------------------------------------------------
+const char * emelf_ar_member_name(struct emelf_ar *ar, int idx)
+{
+	assert((idx >= 0) && (idx < ar->h.member_count));
+
+	return ar->names + AR_U32(ar->member[idx].name_hi, ar->member[idx].name_lo);
+}
+
+// -----------------------------------------------------------------------
+const void * emelf_ar_member_data(struct emelf_ar *ar, int idx, size_t *size)
+{
+	assert((idx >= 0) && (idx < ar->h.member_count));
+
+	struct emelf_ar_member *m = ar->member + idx;
+	*size = AR_U32(m->size_hi, m->size_lo);
+
+	return (char*) ar->map + AR_U32(m->offset_hi, m->offset_lo);
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_ar_member_load(struct emelf_ar *ar, int idx)
+{
+	size_t size;
+	const void *data = emelf_ar_member_data(ar, idx, &size);
+
+	return emelf_load_mem(data, size);
+}
+
+// -----------------------------------------------------------------------
+unsigned emelf_ar_symbol_count(struct emelf_ar *ar)
+{
+	return ar->symbol_count;
+}
+
+// -----------------------------------------------------------------------
+const char * emelf_ar_symbol_name(struct emelf_ar *ar, unsigned idx)
+{
+	assert(idx < ar->symbol_count);
+
+	return ar->names + AR_U32(ar->symbol[idx].name_hi, ar->symbol[idx].name_lo);
+}
+
+// -----------------------------------------------------------------------
+int emelf_ar_symbol_member(struct emelf_ar *ar, unsigned idx)
+{
+	assert(idx < ar->symbol_count);
+
+	return ar->symbol[idx].member;
+}
+
+// -----------------------------------------------------------------------
+int emelf_ar_find(struct emelf_ar *ar, const char *sym_name)
+{
+	unsigned lo = 0;
+	unsigned hi = ar->symbol_count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		int c = strcmp(sym_name, emelf_ar_symbol_name(ar, mid));
+		if (!c) {
+			return ar->symbol[mid].member;
+		} else if (c < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return -1;
+}
+
+// vim: tabstop=4 autoindent
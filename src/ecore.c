@@ -0,0 +1,247 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+// Core snapshots: emulator memory is compared page by page against
+// a shadow copy of the previous snapshot. Full cores store non-zero
+// pages only, delta cores store only pages changed since the previous
+// snapshot. Runs of adjacent stored pages make a single segment.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emelf.h"
+#include "eerr.h"
+
+struct ecore_mem {
+	unsigned id;
+	unsigned size;
+	uint16_t *shadow;
+};
+
+struct emelf_core {
+	unsigned cpu;
+	unsigned abi;
+	int count;				// memory layout of the previous snapshot, 0 if none
+	struct ecore_mem *mem;
+};
+
+static const uint16_t ecore_zero[EMELF_CORE_PAGE];
+
+// -----------------------------------------------------------------------
+struct emelf_core * emelf_core_create(unsigned cpu, unsigned abi)
+{
+	// check CPU and ABI up front, so snapshots fail only on allocation
+	struct emelf *e = emelf_create(EMELF_CORE, cpu, abi);
+	if (!e) {
+		emelf_seterr(EMELF_E_CPU);
+		return NULL;
+	}
+	emelf_destroy(e);
+
+	struct emelf_core *c = calloc(1, sizeof(struct emelf_core));
+	if (!c) {
+		emelf_seterr(EMELF_E_ALLOC);
+		return NULL;
+	}
+
+	c->cpu = cpu;
+	c->abi = abi;
+
+	return c;
+}
+
+// -----------------------------------------------------------------------
+static void ecore_shadow_free(struct emelf_core *c)
+{
+	int i;
+
+	for (i=0 ; i<c->count ; i++) {
+		free(c->mem[i].shadow);
+	}
+	free(c->mem);
+	c->mem = NULL;
+	c->count = 0;
+}
+
+// -----------------------------------------------------------------------
+static int ecore_layout_same(const struct emelf_core *c, const struct emelf_core_mem *mem, int count)
+{
+	int i;
+
+	if (!c->count || (c->count != count)) {
+		return 0;
+	}
+
+	for (i=0 ; i<count ; i++) {
+		if ((c->mem[i].id != mem[i].id) || (c->mem[i].size != mem[i].size)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// -----------------------------------------------------------------------
+static int ecore_shadow_alloc(struct emelf_core *c, const struct emelf_core_mem *mem, int count)
+{
+	int i;
+
+	ecore_shadow_free(c);
+
+	c->mem = calloc(count, sizeof(struct ecore_mem));
+	if (!c->mem) {
+		return EMELF_E_ALLOC;
+	}
+
+	for (i=0 ; i<count ; i++) {
+		c->mem[i].id = mem[i].id;
+		c->mem[i].size = mem[i].size;
+		c->mem[i].shadow = malloc((mem[i].size + 1) * sizeof(uint16_t));
+		if (!c->mem[i].shadow) {
+			c->count = i + 1;
+			return EMELF_E_ALLOC;
+		}
+	}
+	c->count = count;
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int ecore_page_stored(const uint16_t *mem, const uint16_t *shadow, unsigned len, int delta)
+{
+	if (delta) {
+		return memcmp(mem, shadow, len * sizeof(uint16_t)) != 0;
+	} else {
+		return memcmp(mem, ecore_zero, len * sizeof(uint16_t)) != 0;
+	}
+}
+
+// -----------------------------------------------------------------------
+static int ecore_mem_snapshot(struct emelf *e, struct ecore_mem *cm, const uint16_t *mem, int delta)
+{
+	int res;
+	unsigned pos = 0;
+	unsigned start = 0;
+	int run = 0;
+
+	while (pos < cm->size) {
+		unsigned len = cm->size - pos;
+		if (len > EMELF_CORE_PAGE) {
+			len = EMELF_CORE_PAGE;
+		}
+		int stored = ecore_page_stored(mem + pos, cm->shadow + pos, len, delta);
+		if (stored && !run) {
+			start = pos;
+			run = 1;
+		} else if (!stored && run) {
+			res = emelf_segment_add(e, cm->id, start, mem + start, pos - start);
+			if (res != EMELF_E_OK) {
+				return res;
+			}
+			if (delta) {
+				memcpy(cm->shadow + start, mem + start, (pos - start) * sizeof(uint16_t));
+			}
+			run = 0;
+		}
+		pos += len;
+	}
+
+	if (run) {
+		res = emelf_segment_add(e, cm->id, start, mem + start, pos - start);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+		if (delta) {
+			memcpy(cm->shadow + start, mem + start, (pos - start) * sizeof(uint16_t));
+		}
+	}
+
+	// full snapshot becomes the new base for deltas
+	if (!delta) {
+		memcpy(cm->shadow, mem, cm->size * sizeof(uint16_t));
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_core_snapshot(struct emelf_core *c, const struct emelf_core_mem *mem, int count, const uint16_t *regs, unsigned reg_count, int delta)
+{
+	assert(c);
+	assert(mem || !count);
+
+	int i;
+	int res;
+	struct emelf *e = NULL;
+
+	// deltas need previous snapshot of the same memory layout
+	if (!ecore_layout_same(c, mem, count)) {
+		delta = 0;
+		res = ecore_shadow_alloc(c, mem, count);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	e = emelf_create(EMELF_CORE, c->cpu, c->abi);
+	if (!e) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+	if (delta) {
+		e->eh.flags |= EMELF_FLAG_CORE_DELTA;
+	}
+
+	if (regs) {
+		res = emelf_regs_set(e, regs, reg_count);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	for (i=0 ; i<count ; i++) {
+		res = ecore_mem_snapshot(e, c->mem + i, mem[i].mem, delta);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	return e;
+
+cleanup:
+	// shadow may be partially updated, next snapshot has to be a full one
+	ecore_shadow_free(c);
+	emelf_destroy(e);
+	emelf_seterr(res);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+void emelf_core_destroy(struct emelf_core *c)
+{
+	if (!c) {
+		return;
+	}
+
+	ecore_shadow_free(c);
+	free(c);
+}
+
+// vim: tabstop=4 autoindent
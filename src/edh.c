@@ -16,168 +16,362 @@
 //  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stdlib.h>
-#include <stdio.h>
 #include <string.h>
-#include <ctype.h>
 
+#include "emelf.h"
 #include "edh.h"
+#include "ealloc.h"
+
+#define EDH_MIN_SIZE 8
+
+// -----------------------------------------------------------------------
+static unsigned edh_size_for(unsigned count)
+{
+	unsigned size = EDH_MIN_SIZE;
+
+	// keep load factor below 3/4
+	while (size * 3 < count * 4 + 4) {
+		size <<= 1;
+	}
+
+	return size;
+}
+
+// -----------------------------------------------------------------------
+static const char * edh_name(struct edh_table *dh, uint32_t idx)
+{
+	return dh->e->symbol_names + dh->e->symbol[idx-1].offset;
+}
+
+// -----------------------------------------------------------------------
+static void edh_insert_slot(struct edh_slot *slots, unsigned size, struct edh_slot *s)
+{
+	unsigned mask = size - 1;
+	unsigned pos = s->hash & mask;
+
+	while (slots[pos].idx) {
+		pos = (pos + 1) & mask;
+	}
+
+	slots[pos] = *s;
+}
 
 // -----------------------------------------------------------------------
-struct edh_table * edh_create(int size)
+static int edh_resize(struct edh_table *dh, unsigned size)
 {
-	struct edh_table *dh = malloc(sizeof(struct edh_table));
+	unsigned i;
+
+	struct edh_slot *slots = ea_zalloc(dh->e->alloc, size * sizeof(struct edh_slot));
+	if (!slots) {
+		return -1;
+	}
+
+	for (i=0 ; i<dh->size ; i++) {
+		if (dh->slots[i].idx) {
+			edh_insert_slot(slots, size, dh->slots + i);
+		}
+	}
+
+	ea_free(dh->e->alloc, dh->slots, dh->size * sizeof(struct edh_slot));
+	dh->slots = slots;
+	dh->size = size;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+struct edh_table * edh_create(struct emelf *e, unsigned count)
+{
+	struct edh_table *dh = ea_alloc(e->alloc, sizeof(struct edh_table));
 	if (!dh) {
 		return NULL;
 	}
 
-	dh->slots = calloc(size, sizeof(struct edh_elem));
+	dh->e = e;
+	dh->size = edh_size_for(count);
+	dh->count = 0;
+	dh->slots = ea_zalloc(e->alloc, dh->size * sizeof(struct edh_slot));
 	if (!dh->slots) {
-		free(dh);
+		ea_free(e->alloc, dh, sizeof(struct edh_table));
 		return NULL;
 	}
-	dh->size = size;
 
 	return dh;
 }
 
 // -----------------------------------------------------------------------
-unsigned edh_hash(struct edh_table *dh, char *str)
+unsigned edh_hash(const char *str)
 {
-	unsigned v = 0;
-	char *c = str;
+	// 32-bit FNV-1a
+	uint32_t v = 2166136261u;
+	const unsigned char *c = (const unsigned char *) str;
 
 	while (c && *c) {
-		v = *c + (v<<5) - v;
+		v ^= *c;
+		v *= 16777619u;
 		c++;
 	}
 
-	return v % dh->size;
+	return v;
 }
 
 // -----------------------------------------------------------------------
-struct emelf_symbol * edh_get(struct edh_table *dh, char *name)
+static int edh_find(struct edh_table *dh, const char *name, uint32_t hash)
 {
-	unsigned hash = edh_hash(dh, name);
-	struct edh_elem *elem = dh->slots[hash];
+	unsigned mask = dh->size - 1;
+	unsigned pos = hash & mask;
 
-	while (elem) {
-		if (!strcmp(name, elem->name)) {
-			return elem->s;
+	while (dh->slots[pos].idx) {
+		if ((dh->slots[pos].hash == hash) && !strcmp(name, edh_name(dh, dh->slots[pos].idx))) {
+			return pos;
 		}
-		elem = elem->next;
+		pos = (pos + 1) & mask;
 	}
 
-	return NULL;
+	return -1;
 }
 
 // -----------------------------------------------------------------------
-struct emelf_symbol * edh_add(struct edh_table *dh, char *name, struct emelf_symbol *s)
+int edh_get(struct edh_table *dh, const char *name)
 {
-	unsigned hash = edh_hash(dh, name);
-	struct edh_elem *elem = dh->slots[hash];
+	if (!dh) {
+		return -1;
+	}
 
-	while (elem) {
-		if (!strcmp(name, elem->name)) {
-			return NULL;
+	int pos = edh_find(dh, name, edh_hash(name));
+	if (pos < 0) {
+		return -1;
+	}
+
+	return dh->slots[pos].idx - 1;
+}
+
+// -----------------------------------------------------------------------
+int edh_lookup(struct edh_table *dh, const char *name, unsigned hash)
+{
+	int pos = edh_find(dh, name, hash);
+	if (pos < 0) {
+		return -1;
+	}
+
+	return dh->slots[pos].idx - 1;
+}
+
+// -----------------------------------------------------------------------
+int edh_insert(struct edh_table *dh, int idx, unsigned hash)
+{
+	// symbol is known not to be in the table
+	struct edh_slot s = {
+		.hash = hash,
+		.idx = idx + 1,
+	};
+
+	if ((dh->count + 1) * 4 > dh->size * 3) {
+		if (edh_resize(dh, dh->size << 1)) {
+			return -1;
 		}
-		elem = elem->next;
 	}
 
-	struct edh_elem *new_elem = malloc(sizeof(struct edh_elem));
-	new_elem->name = strdup(name);
-	new_elem->s = s;
-	new_elem->next = dh->slots[hash];
-	dh->slots[hash] = new_elem;
+	edh_insert_slot(dh->slots, dh->size, &s);
+	dh->count++;
 
-	return new_elem->s;
+	return 0;
 }
 
 // -----------------------------------------------------------------------
-int edh_delete(struct edh_table *dh, char *name)
+int edh_add(struct edh_table *dh, int idx)
 {
-	unsigned hash = edh_hash(dh, name);
-	struct edh_elem *prev = NULL;
-	struct edh_elem *elem = dh->slots[hash];
+	const char *name = dh->e->symbol_names + dh->e->symbol[idx].offset;
+	unsigned hash = edh_hash(name);
 
-    while (elem) {
-        if (!strcmp(name, elem->name)) {
-			if (prev) {
-				prev->next = elem->next;
-			} else {
-				dh->slots[hash] = elem->next;
-			}
-			free(elem->name);
-			free(elem);
-            return 0;
-        }
-		prev = elem;
-        elem = elem->next;
-    }
-	return -1;
+	if (edh_find(dh, name, hash) >= 0) {
+		return 1;
+	}
+
+	return edh_insert(dh, idx, hash);
+}
+
+// -----------------------------------------------------------------------
+int edh_reserve(struct edh_table *dh, unsigned count)
+{
+	unsigned size = edh_size_for(count);
+
+	if (size <= dh->size) {
+		return 0;
+	}
+
+	return edh_resize(dh, size);
+}
+
+// -----------------------------------------------------------------------
+int edh_delete(struct edh_table *dh, const char *name)
+{
+	unsigned mask = dh->size - 1;
+	int i = edh_find(dh, name, edh_hash(name));
+	int j = i;
+
+	if (i < 0) {
+		return -1;
+	}
+
+	// backward-shift following elements that would become unreachable
+	while (1) {
+		j = (j + 1) & mask;
+		if (!dh->slots[j].idx) {
+			break;
+		}
+		int home = dh->slots[j].hash & mask;
+		int stays = (i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j));
+		if (!stays) {
+			dh->slots[i] = dh->slots[j];
+			i = j;
+		}
+	}
+
+	dh->slots[i].idx = 0;
+	dh->count--;
+
+	return 0;
 }
 
 // -----------------------------------------------------------------------
 void edh_destroy(struct edh_table *dh)
+{
+	if (!dh) return;
+
+	ea_free(dh->e->alloc, dh->slots, dh->size * sizeof(struct edh_slot));
+	ea_free(dh->e->alloc, dh, sizeof(struct edh_table));
+}
+
+// -----------------------------------------------------------------------
+static int edh_verify(struct edh_table *dh)
+{
+	unsigned i;
+	unsigned mask = dh->size - 1;
+	unsigned empty = 0;
+	unsigned run = 0;
+	unsigned bad = 0;
+	int res = -1;
+
+	char *seen = ea_zalloc(dh->e->alloc, dh->count + 1);
+	if (!seen) {
+		return -1;
+	}
+
+	// table is at most 3/4 full, so there is an empty slot to start from
+	while (dh->slots[empty].idx) {
+		empty++;
+	}
+
+	// Each symbol has to be there once, reachable from its home slot
+	// (no empty slot in between). Hashes aren't checked against names,
+	// that costs as much as building the index anew. Occupied and empty
+	// slots are mixed randomly, so it's done without branches.
+	for (i=1 ; i<=dh->size ; i++) {
+		struct edh_slot *s = dh->slots + ((empty + i) & mask);
+		unsigned used = s->idx != 0;
+		bad |= used & (seen[s->idx] | (((empty + i - s->hash) & mask) > run));
+		seen[s->idx] = 1;
+		run = (run + 1) & -used;
+	}
+	if (bad) {
+		goto cleanup;
+	}
+
+	res = 0;
+
+cleanup:
+	ea_free(dh->e->alloc, seen, dh->count + 1);
+	return res;
+}
+
+// -----------------------------------------------------------------------
+struct edh_table * edh_import(struct emelf *e, struct edh_slot *slots, const struct emelf_hash_slot *hs, unsigned size)
 {
 	int i;
-	struct edh_elem *elem;
-	struct edh_elem *tmp;
+	unsigned count = 0;
 
-	if (!dh) return;
+	// table needs to be a power of 2, with some room left
+	if ((size < EDH_MIN_SIZE) || (size & (size-1)) || ((unsigned) e->symbol_count * 4 > size * 3)) {
+		return NULL;
+	}
 
-	for(i=0 ; i<dh->size ; i++) {
-		elem = dh->slots[i];
-		while (elem) {
-			tmp = elem->next;
-			free(elem->name);
-			free(elem);
-			elem = tmp;
+	// Slots are converted backwards, so hs may point to the beginning
+	// of slots: a wider slot never overwrites a packed one not read yet.
+	for (i=size-1 ; i>=0 ; i--) {
+		uint32_t hash = ((uint32_t) hs[i].hash_hi << 16) | hs[i].hash_lo;
+		uint32_t idx = hs[i].idx;
+		if (idx > (unsigned) e->symbol_count) {
+			return NULL;
+		}
+		if (idx) {
+			count++;
 		}
+		slots[i].hash = hash;
+		slots[i].idx = idx;
 	}
 
-	free(dh->slots);
-	free(dh);
+	// every symbol needs to be in the table
+	if (count != (unsigned) e->symbol_count) {
+		return NULL;
+	}
+
+	struct edh_table *dh = ea_alloc(e->alloc, sizeof(struct edh_table));
+	if (!dh) {
+		return NULL;
+	}
+
+	dh->e = e;
+	dh->size = size;
+	dh->count = count;
+	dh->slots = slots;
+
+	if (edh_verify(dh)) {
+		ea_free(e->alloc, dh, sizeof(struct edh_table));
+		return NULL;
+	}
+
+	return dh;
 }
 
 // -----------------------------------------------------------------------
-void edh_dump_stats(struct edh_table *dh)
+void edh_export(struct edh_table *dh, struct emelf_hash_slot *hs, unsigned start, unsigned count)
 {
-	int i;
-	int elem_total = 0, collisions = 0, max_depth = 0;
+	unsigned i;
+
+	for (i=0 ; i<count ; i++) {
+		struct edh_slot *s = dh->slots + start + i;
+		hs[i].hash_hi = s->hash >> 16;
+		hs[i].hash_lo = s->hash & 0xffff;
+		hs[i].idx = s->idx;
+	}
+}
+
+// -----------------------------------------------------------------------
+void edh_stats(struct edh_table *dh, struct emelf_hash_stats *hs)
+{
+	unsigned i;
+	unsigned mask;
+	unsigned long total_probes = 0;
 
-	struct edh_elem *elem;
+	memset(hs, 0, sizeof(struct emelf_hash_stats));
 
 	if (!dh) return;
 
-	unsigned *elem_slot = calloc(dh->size, sizeof(int));
-
-	for(i=0 ; i<dh->size ; i++) {
-		elem = dh->slots[i];
-		int depth = 0;
-		while (elem) {
-			elem_total++;
-			elem_slot[i]++;
-			if (elem_slot[i] > 1) {
-				collisions++;
-			}
-			elem = elem->next;
-			if (depth > max_depth) max_depth = depth;
-		}
-	}
+	mask = dh->size - 1;
+	hs->slots = dh->size;
+	hs->count = dh->count;
 
-	printf("-----------------------------------\n");
-	printf("      Slots: %d\n", dh->size);
-	printf("   Elements: %d\n", elem_total);
-	printf("  Max depth: %d\n", max_depth);
-	printf(" Collisions: %d\n", collisions);
-	printf("   Collided: \n");
-	for(i=0 ; i<dh->size ; i++) {
-		if (elem_slot[i] > 1) {
-			printf(" %10d: %d\n", i, elem_slot[i]-1);
-		}
+	// probes needed to find a symbol: distance from its home slot + 1
+	for (i=0 ; i<dh->size ; i++) {
+		if (!dh->slots[i].idx) continue;
+		unsigned probes = ((i - dh->slots[i].hash) & mask) + 1;
+		total_probes += probes;
+		if (probes > 1) hs->displaced++;
+		if (probes > hs->max_probes) hs->max_probes = probes;
 	}
 
-	free(elem_slot);
+	hs->avg_probes = dh->count ? (double) total_probes / dh->count : 0.0;
 }
 
 // vim: tabstop=4 autoindent
@@ -0,0 +1,99 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "emelf.h"
+
+// -----------------------------------------------------------------------
+static size_t stdio_read(void *ctx, void *buf, size_t len)
+{
+	return fread(buf, 1, len, ctx);
+}
+
+// -----------------------------------------------------------------------
+static size_t stdio_write(void *ctx, const void *buf, size_t len)
+{
+	return fwrite(buf, 1, len, ctx);
+}
+
+// -----------------------------------------------------------------------
+static int stdio_seek(void *ctx, long offset)
+{
+	return fseek(ctx, offset, SEEK_SET) ? -1 : 0;
+}
+
+const struct emelf_io emelf_io_stdio = {
+	.read = stdio_read,
+	.write = stdio_write,
+	.seek = stdio_seek,
+};
+
+// -----------------------------------------------------------------------
+static size_t mem_read(void *ctx, void *buf, size_t len)
+{
+	struct emelf_membuf *mb = ctx;
+
+	if (len > mb->size - mb->pos) {
+		len = mb->size - mb->pos;
+	}
+	if (len) {
+		memcpy(buf, (char*) mb->buf + mb->pos, len);
+		mb->pos += len;
+	}
+
+	return len;
+}
+
+// -----------------------------------------------------------------------
+static size_t mem_write(void *ctx, const void *buf, size_t len)
+{
+	struct emelf_membuf *mb = ctx;
+
+	if (len > mb->size - mb->pos) {
+		len = mb->size - mb->pos;
+	}
+	if (len) {
+		memcpy((char*) mb->buf + mb->pos, buf, len);
+		mb->pos += len;
+	}
+
+	return len;
+}
+
+// -----------------------------------------------------------------------
+static int mem_seek(void *ctx, long offset)
+{
+	struct emelf_membuf *mb = ctx;
+
+	if ((offset < 0) || ((size_t) offset > mb->size)) {
+		return -1;
+	}
+	mb->pos = offset;
+
+	return 0;
+}
+
+const struct emelf_io emelf_io_mem = {
+	.read = mem_read,
+	.write = mem_write,
+	.seek = mem_seek,
+};
+
+// vim: tabstop=4 autoindent
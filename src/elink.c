@@ -0,0 +1,318 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emelf.h"
+#include "edh.h"
+#include "eerr.h"
+#include "erel.h"
+
+// Global symbol index: one open-addressing table over GLOBAL symbols
+// of all linked objects, sized up front so it never grows.
+struct elink_slot {
+	uint32_t hash;
+	uint32_t obj;
+	uint32_t idx; // symbol index + 1, 0 = empty slot
+};
+
+struct elink {
+	struct emelf **obj;
+	int count;
+	unsigned *base;
+	unsigned size; // always power of 2
+	struct elink_slot *slots;
+	uint16_t *value;
+	char *addr;
+};
+
+// -----------------------------------------------------------------------
+static const char * elink_name(struct emelf *e, int idx)
+{
+	return e->symbol_names + e->symbol[idx].offset;
+}
+
+// -----------------------------------------------------------------------
+static struct elink_slot * elink_index_find(struct elink *l, const char *name, unsigned hash)
+{
+	unsigned mask = l->size - 1;
+	unsigned i = hash & mask;
+
+	while (l->slots[i].idx) {
+		struct elink_slot *s = l->slots + i;
+		if ((s->hash == hash) && !strcmp(elink_name(l->obj[s->obj], s->idx-1), name)) {
+			return s;
+		}
+		i = (i + 1) & mask;
+	}
+
+	return l->slots + i;
+}
+
+// -----------------------------------------------------------------------
+static int elink_index_build(struct elink *l, char **sym_name)
+{
+	int o, i;
+	unsigned count = 0;
+
+	for (o=0 ; o<l->count ; o++) {
+		struct emelf *e = l->obj[o];
+		for (i=0 ; i<e->symbol_count ; i++) {
+			if (e->symbol[i].flags & EMELF_SYM_GLOBAL) {
+				count++;
+			}
+		}
+	}
+
+	// keep load at or below 1/2
+	l->size = 8;
+	while (l->size < count * 2) {
+		l->size <<= 1;
+	}
+	l->slots = calloc(l->size, sizeof(struct elink_slot));
+	if (!l->slots) {
+		return EMELF_E_ALLOC;
+	}
+
+	for (o=0 ; o<l->count ; o++) {
+		struct emelf *e = l->obj[o];
+		for (i=0 ; i<e->symbol_count ; i++) {
+			if (!(e->symbol[i].flags & EMELF_SYM_GLOBAL)) {
+				continue;
+			}
+			const char *name = elink_name(e, i);
+			unsigned hash = edh_hash(name);
+			struct elink_slot *s = elink_index_find(l, name, hash);
+			if (s->idx) {
+				if (sym_name) *sym_name = (char*) name;
+				return EMELF_E_DUPSYM;
+			}
+			s->hash = hash;
+			s->obj = o;
+			s->idx = i + 1;
+		}
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int elink_resolve(struct elink *l, int o, char **sym_name)
+{
+	int i;
+	struct emelf *e = l->obj[o];
+
+	// each symbol is resolved once per object, not once per relocation
+	for (i=0 ; i<e->symbol_count ; i++) {
+		struct emelf *def = e;
+		int idx = i;
+		unsigned base = l->base[o];
+
+		if (!(e->symbol[i].flags & EMELF_SYM_GLOBAL)) {
+			const char *name = elink_name(e, i);
+			struct elink_slot *s = elink_index_find(l, name, edh_hash(name));
+			if (!s->idx) {
+				if (sym_name) *sym_name = (char*) name;
+				return EMELF_E_UNDEF;
+			}
+			def = l->obj[s->obj];
+			idx = s->idx - 1;
+			base = l->base[s->obj];
+		}
+
+		if (def->symbol[idx].flags & EMELF_SYM_RELATIVE) {
+			l->value[i] = def->symbol[idx].value + base;
+			l->addr[i] = 1;
+		} else {
+			l->value[i] = def->symbol[idx].value;
+			l->addr[i] = 0;
+		}
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int elink_prepare(struct emelf *e, struct emelf *first)
+{
+	if (e->eh.type != EMELF_RELOC) {
+		return EMELF_E_TYPE;
+	}
+	if (e->eh.cpu != first->eh.cpu) {
+		return EMELF_E_CPU;
+	}
+	if (e->eh.abi != first->eh.abi) {
+		return EMELF_E_ABI;
+	}
+
+	// lazily loaded objects need everything now
+	return emelf_sections_load(e);
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_link(struct emelf **obj, int count, char **sym_name)
+{
+	int o;
+	int res;
+	int max_symbols = 0;
+	struct emelf *out = NULL;
+	struct elink l = { obj, count, NULL, 0, NULL, NULL, NULL };
+
+	if (count <= 0) {
+		res = EMELF_E_COUNT;
+		goto cleanup;
+	}
+
+	out = emelf_create(EMELF_EXEC, obj[0]->eh.cpu, obj[0]->eh.abi);
+	if (!out) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+
+	l.base = malloc(count * sizeof(unsigned));
+	if (!l.base) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+
+	// lay out images one after another
+	for (o=0 ; o<count ; o++) {
+		struct emelf *e = obj[o];
+
+		res = elink_prepare(e, obj[0]);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+
+		l.base[o] = out->image_size;
+		res = emelf_image_append(out, e->image, e->image_size);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+
+		if (emelf_has_entry(e) && !emelf_has_entry(out)) {
+			res = emelf_entry_set(out, l.base[o] + e->eh.entry);
+			if (res != EMELF_E_OK) {
+				goto cleanup;
+			}
+		}
+
+		if (e->symbol_count > max_symbols) {
+			max_symbols = e->symbol_count;
+		}
+	}
+
+	res = elink_index_build(&l, sym_name);
+	if (res != EMELF_E_OK) {
+		goto cleanup;
+	}
+
+	// per-object symbol values, reused for each object
+	l.value = malloc((max_symbols + 1) * sizeof(uint16_t));
+	l.addr = malloc(max_symbols + 1);
+	if (!l.value || !l.addr) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+
+	for (o=0 ; o<count ; o++) {
+		res = elink_resolve(&l, o, sym_name);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+		struct erel r = {
+			out->image + l.base[o], obj[o]->image_size, l.base[o],
+			obj[o]->reloc, obj[o]->reloc_count,
+			l.value, l.addr, obj[o]->symbol_count
+		};
+		res = erel_apply(&r, 1);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	free(l.base);
+	free(l.slots);
+	free(l.value);
+	free(l.addr);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		emelf_destroy(out);
+		return NULL;
+	}
+	return out;
+}
+
+// -----------------------------------------------------------------------
+int emelf_relocate(struct emelf *e, unsigned base, int threads)
+{
+	assert(e);
+
+	int i;
+	int res;
+	uint16_t *value = NULL;
+	char *addr = NULL;
+
+	if (e->eh.type != EMELF_RELOC) {
+		return EMELF_E_TYPE;
+	}
+
+	if (base + e->image_size > e->amax) {
+		return EMELF_E_ADDR;
+	}
+
+	res = emelf_sections_load(e);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	value = malloc((e->symbol_count + 1) * sizeof(uint16_t));
+	addr = malloc(e->symbol_count + 1);
+	if (!value || !addr) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+
+	// all symbols have to be defined within the object
+	for (i=0 ; i<e->symbol_count ; i++) {
+		struct emelf_symbol *s = e->symbol + i;
+		if (!(s->flags & EMELF_SYM_GLOBAL)) {
+			res = EMELF_E_UNDEF;
+			goto cleanup;
+		}
+		addr[i] = (s->flags & EMELF_SYM_RELATIVE) ? 1 : 0;
+		value[i] = s->value + (addr[i] ? base : 0);
+	}
+
+	struct erel r = {
+		e->image, e->image_size, base,
+		e->reloc, e->reloc_count,
+		value, addr, e->symbol_count
+	};
+	res = erel_apply(&r, threads);
+
+cleanup:
+	free(value);
+	free(addr);
+	return res;
+}
+
+// vim: tabstop=4 autoindent
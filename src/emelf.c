@@ -19,67 +19,116 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "emelf.h"
 #include "edh.h"
+#include "eaddr.h"
+#include "eswap.h"
+#include "ealloc.h"
+#include "eerr.h"
+#include "erle.h"
+#include "estats.h"
+#include "estrtab.h"
+
+#define NWRITE_CHUNK 2048
 
 int emelf_errno;
+static __thread int emelf_tls_errno;
+
+static int emelf_lazy_load(struct emelf *e, unsigned types);
+static int emelf_section_elem_size(int type);
 
 // -----------------------------------------------------------------------
-static void ahtons(uint16_t *t, int len)
+void emelf_seterr(int err)
 {
-	int pos = len-1;
-	while (pos >= 0) {
-		t[pos] = htons(t[pos]);
-		pos--;
-	}
+	emelf_tls_errno = err;
+	// process-wide copy is kept for compatibility only
+	__atomic_store_n(&emelf_errno, err, __ATOMIC_RELAXED);
+}
+
+// -----------------------------------------------------------------------
+int emelf_error(void)
+{
+	return emelf_tls_errno;
 }
 
 // -----------------------------------------------------------------------
 static void antohs(uint16_t *t, int len)
 {
-	int pos = len-1;
-	while (pos >= 0) {
-		t[pos] = ntohs(t[pos]);
-		pos--;
+	if (estats_on) {
+		uint64_t start = estats_now();
+		eswap(t, len);
+		estats_swap_ns += estats_now() - start;
+	} else {
+		eswap(t, len);
 	}
 }
 
 // -----------------------------------------------------------------------
-static size_t nfread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+static int nread(const struct emelf_io *io, void *ctx, void *ptr, size_t size, size_t nmemb)
 {
-	int res = fread(ptr, size, nmemb, stream);
-	if (res < 0) {
-		return res;
+	if (io->read(ctx, ptr, size * nmemb) != size * nmemb) {
+		return -1;
 	}
 
 	antohs(ptr, size * nmemb / 2);
 
-	return res;
+	return nmemb;
 }
 
 // -----------------------------------------------------------------------
-static size_t nfwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+static int nwrite(const struct emelf_io *io, void *ctx, const void *ptr, size_t size, size_t nmemb)
 {
-	uint16_t *tmp = malloc(size * nmemb);
-	if (!tmp) {
-		return -1;
+	uint16_t chunk[NWRITE_CHUNK];
+	const uint16_t *src = ptr;
+	size_t left = size * nmemb / SIZE_WORD;
+
+	// swap through a fixed-size buffer, so writes don't touch the heap
+	while (left > 0) {
+		size_t len = (left < NWRITE_CHUNK) ? left : NWRITE_CHUNK;
+		if (estats_on) {
+			uint64_t start = estats_now();
+			eswap_copy(chunk, src, len);
+			estats_swap_ns += estats_now() - start;
+		} else {
+			eswap_copy(chunk, src, len);
+		}
+		if (io->write(ctx, chunk, len * SIZE_WORD) != len * SIZE_WORD) {
+			return -1;
+		}
+		src += len;
+		left -= len;
 	}
-	memcpy(tmp, ptr, size * nmemb);
-	ahtons(tmp, size * nmemb / 2);
 
-	int res = fwrite(tmp, size, nmemb, stream);
+	return nmemb;
+}
 
-	free(tmp);
-	return res;
+// -----------------------------------------------------------------------
+static unsigned emelf_amax(unsigned cpu)
+{
+	switch (cpu) {
+		case EMELF_CPU_MX16:
+			return IMAGE_MAX_MX16;
+		case EMELF_CPU_MERA400:
+			return IMAGE_MAX_MERA400;
+		default:
+			return 0;
+	}
 }
 
 // -----------------------------------------------------------------------
-struct emelf * emelf_create(unsigned type, unsigned cpu, unsigned abi)
+struct emelf * emelf_create_a(unsigned type, unsigned cpu, unsigned abi, const struct emelf_allocator *a)
 {
 	struct emelf *e = NULL;
 
+	if (!a) {
+		a = &emelf_allocator_malloc;
+	}
+
 	if ((type <= EMELF_UNKNOWN) || (type >= EMELF_TYPE_MAX)) {
 		goto cleanup;
 	}
@@ -88,10 +137,11 @@ struct emelf * emelf_create(unsigned type, unsigned cpu, unsigned abi)
 		goto cleanup;
 	}
 
-	e = calloc(1, SIZE_EMELF);
+	e = ea_zalloc(a, SIZE_EMELF);
 	if (!e) {
 		goto cleanup;
 	}
+	e->alloc = a;
 
 	// fill in header
 	strncpy(e->eh.magic, EMELF_MAGIC, EMELF_MAGIC_LEN);
@@ -101,24 +151,26 @@ struct emelf * emelf_create(unsigned type, unsigned cpu, unsigned abi)
 	e->eh.abi = abi;
 
 	// update max addr according to CPU
-	switch (e->eh.cpu) {
-		case EMELF_CPU_MX16:
-			e->amax = IMAGE_MAX_MX16;
-			break;
-		case EMELF_CPU_MERA400:
-			e->amax = IMAGE_MAX_MERA400;
-			break;
-		default:
-			goto cleanup;
+	e->amax = emelf_amax(e->eh.cpu);
+	if (!e->amax) {
+		goto cleanup;
 	}
 
+	estats_attach(e);
+
 	return e;
 
 cleanup:
-	free(e);
+	ea_free(a, e, SIZE_EMELF);
 	return NULL;
 }
 
+// -----------------------------------------------------------------------
+struct emelf * emelf_create(unsigned type, unsigned cpu, unsigned abi)
+{
+	return emelf_create_a(type, cpu, abi, NULL);
+}
+
 // -----------------------------------------------------------------------
 void emelf_destroy(struct emelf *e)
 {
@@ -126,12 +178,30 @@ void emelf_destroy(struct emelf *e)
 		return;
 	}
 
-	free(e->section);
-	free(e->reloc);
-	free(e->symbol);
-	free(e->symbol_names);
+	ea_free(e->alloc, e->section, e->section_slots * SIZE_SECTION);
+	if (!e->map) {
+		int i;
+		for (i=0 ; i<e->segment_count ; i++) {
+			ea_free(e->alloc, e->segment[i].data, e->segment[i].size * SIZE_WORD);
+		}
+		ea_free(e->alloc, e->regs, e->reg_count * SIZE_WORD);
+	}
+	ea_free(e->alloc, e->segment, e->segment_slots * sizeof(struct emelf_segment));
+	if (e->map) {
+		// mapped objects own only a decoded image
+		if (e->image_slots) {
+			ea_free(e->alloc, e->image, e->image_slots * SIZE_WORD);
+		}
+		munmap(e->map, e->map_size);
+	} else {
+		ea_free(e->alloc, e->image, e->image_slots * SIZE_WORD);
+		ea_free(e->alloc, e->reloc, e->reloc_slots * SIZE_RELOC);
+		ea_free(e->alloc, e->symbol, e->symbol_slots * SIZE_SYMBOL);
+		ea_free(e->alloc, e->symbol_names, e->symbol_names_space);
+	}
 	edh_destroy(e->hsymbol);
-	free(e);
+	eaddr_destroy(e->haddr);
+	ea_free(estats_detach(e), e, SIZE_EMELF);
 }
 
 // -----------------------------------------------------------------------
@@ -149,22 +219,37 @@ int emelf_entry_set(struct emelf *e, unsigned a)
 	return EMELF_E_OK;
 }
 
+// -----------------------------------------------------------------------
+static unsigned emelf_grow(unsigned slots, unsigned need)
+{
+	// double the storage, starting with ALLOC_SEGMENT elements
+	unsigned grown = (slots < ALLOC_SEGMENT / 2) ? ALLOC_SEGMENT : slots * 2;
+
+	return (grown < need) ? need : grown;
+}
+
 // -----------------------------------------------------------------------
 int emelf_section_add(struct emelf *e, int type)
 {
 	assert(e);
 
+	if (e->map) {
+		return EMELF_E_RDONLY;
+	}
+
 	if (e->eh.sec_count >= 65535) {
 		return EMELF_E_COUNT;
 	}
 
 	// reallocate sections if necessary
-	while (e->eh.sec_count >= e->section_slots) {
-		e->section_slots += ALLOC_SEGMENT;
-		e->section = realloc(e->section, e->section_slots * SIZE_SECTION);
-		if (!e->section) {
+	if (e->eh.sec_count >= e->section_slots) {
+		unsigned slots = emelf_grow(e->section_slots, e->eh.sec_count + 1);
+		struct emelf_section *section = ea_realloc(e->alloc, e->section, e->section_slots * SIZE_SECTION, slots * SIZE_SECTION);
+		if (!section) {
 			return EMELF_E_ALLOC;
 		}
+		e->section = section;
+		e->section_slots = slots;
 	}
 
 	e->section[e->eh.sec_count].type = type;
@@ -184,6 +269,14 @@ int emelf_image_append(struct emelf *e, uint16_t *i, unsigned ilen)
 		return EMELF_E_OK;
 	}
 
+	if (e->map) {
+		return EMELF_E_RDONLY;
+	}
+
+	if (e->image_size + ilen > e->amax) {
+		return EMELF_E_ADDR;
+	}
+
 	// add image section
 	if (e->image_size <= 0) {
 		res = emelf_section_add(e, EMELF_SEC_IMAGE);
@@ -192,8 +285,21 @@ int emelf_image_append(struct emelf *e, uint16_t *i, unsigned ilen)
 		}
 	}
 
-	if (e->image_size + ilen > e->amax) {
-		return EMELF_E_ADDR;
+	// grow image geometrically, up to max address
+	if (e->image_size + ilen > e->image_slots) {
+		unsigned slots = e->image_slots * 2;
+		if (slots < e->image_size + ilen) {
+			slots = e->image_size + ilen;
+		}
+		if (slots > e->amax) {
+			slots = e->amax;
+		}
+		uint16_t *image = ea_realloc(e->alloc, e->image, e->image_slots * SIZE_WORD, slots * SIZE_WORD);
+		if (!image) {
+			return EMELF_E_ALLOC;
+		}
+		e->image = image;
+		e->image_slots = slots;
 	}
 
 	memcpy(e->image + e->image_size, i, SIZE_WORD * ilen);
@@ -209,6 +315,15 @@ int emelf_reloc_add(struct emelf *e, unsigned addr, unsigned flags, int sym_idx)
 
 	int res;
 
+	if (e->map) {
+		return EMELF_E_RDONLY;
+	}
+
+	res = emelf_lazy_load(e, 1 << EMELF_SEC_RELOC);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
 	if (e->reloc_count >= 65535) {
 		return EMELF_E_COUNT;
 	}
@@ -226,12 +341,14 @@ int emelf_reloc_add(struct emelf *e, unsigned addr, unsigned flags, int sym_idx)
 	}
 
 	// reallocate relocations if necessary
-	while (e->reloc_count >= e->reloc_slots) {
-		e->reloc_slots += ALLOC_SEGMENT;
-		e->reloc = realloc(e->reloc, e->reloc_slots * SIZE_RELOC);
-		if (!e->reloc) {
+	if (e->reloc_count >= e->reloc_slots) {
+		unsigned slots = emelf_grow(e->reloc_slots, e->reloc_count + 1);
+		struct emelf_reloc *reloc = ea_realloc(e->alloc, e->reloc, e->reloc_slots * SIZE_RELOC, slots * SIZE_RELOC);
+		if (!reloc) {
 			return EMELF_E_ALLOC;
 		}
+		e->reloc = reloc;
+		e->reloc_slots = slots;
 	}
 
 	struct emelf_reloc *r = e->reloc + e->reloc_count;
@@ -246,301 +363,1720 @@ int emelf_reloc_add(struct emelf *e, unsigned addr, unsigned flags, int sym_idx)
 }
 
 // -----------------------------------------------------------------------
-int emelf_symbol_add(struct emelf *e, unsigned flags, char *sym_name, uint16_t value)
+static int emelf_segment_alloc(struct emelf *e, int count)
+{
+	if (count <= e->segment_slots) {
+		return EMELF_E_OK;
+	}
+
+	struct emelf_segment *segment = ea_realloc(e->alloc, e->segment, e->segment_slots * sizeof(struct emelf_segment), count * sizeof(struct emelf_segment));
+	if (!segment) {
+		return EMELF_E_ALLOC;
+	}
+	e->segment = segment;
+	e->segment_slots = count;
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int emelf_segment_add(struct emelf *e, unsigned id, unsigned addr, const uint16_t *data, unsigned size)
 {
 	assert(e);
 
 	int res;
-	struct emelf_symbol *sym;
 
-	if (e->symbol_count >= 65535) {
-		return EMELF_E_COUNT;
+	if (e->map) {
+		return EMELF_E_RDONLY;
 	}
 
-	// add symbol sections and hash if none
-	if (!e->symbol_slots) {
-		res = emelf_section_add(e, EMELF_SEC_SYM);
-		if (res != EMELF_E_OK) {
-			emelf_errno = res;
-			return -1;
-		}
-		res = emelf_section_add(e, EMELF_SEC_SYM_NAMES);
-		if (res != EMELF_E_OK) {
-			emelf_errno = res;
-			return -1;
-		}
-		e->hsymbol = edh_create(16000);
+	res = emelf_lazy_load(e, 1 << EMELF_SEC_SEGMENT);
+	if (res != EMELF_E_OK) {
+		return res;
 	}
 
-	// if symbol is defined, return its index
-	sym = edh_get(e->hsymbol, sym_name);
-	if (sym) {
-		return sym - e->symbol;
+	if ((id > 65535) || (size > UINT32_MAX - EMELF_SEGMENT_HDR)) {
+		return EMELF_E_ADDR;
 	}
 
-	// pad symbol names to 16-bit
-	int sym_name_len = strlen(sym_name) + 1;
-	if (sym_name_len % 2) sym_name_len++;
-
-	// realloc symbol_names if necessary
-	while (e->symbol_names_len + sym_name_len >= e->symbol_names_space) {
-		e->symbol_names_space += ALLOC_SEGMENT;
-		e->symbol_names = realloc(e->symbol_names, e->symbol_names_space);
-		if (!e->symbol_names) {
-			emelf_errno = EMELF_E_ALLOC;
-			return -1;
+	if (e->segment_count >= e->segment_slots) {
+		res = emelf_segment_alloc(e, emelf_grow(e->segment_slots, e->segment_count + 1));
+		if (res != EMELF_E_OK) {
+			return res;
 		}
 	}
 
-	// realloc symbols if necessary
-	while (e->symbol_count >= e->symbol_slots) {
-		e->symbol_slots += ALLOC_SEGMENT;
-		e->symbol = realloc(e->symbol, e->symbol_slots * SIZE_SYMBOL);
-		if (!e->symbol) {
-			emelf_errno = EMELF_E_ALLOC;
-			return -1;
-		}
+	struct emelf_segment *seg = e->segment + e->segment_count;
+	seg->data = ea_alloc(e->alloc, size * SIZE_WORD);
+	if (!seg->data && size) {
+		return EMELF_E_ALLOC;
 	}
 
-	struct emelf_symbol *s = e->symbol + e->symbol_count;
-
-	// store symbol
-	s->flags = flags;
-	s->offset = e->symbol_names_len;
-	s->value = value;
-
-	// store symbol name (and pad)
-	strcpy(e->symbol_names + e->symbol_names_len, sym_name);
-	e->symbol_names_len += sym_name_len;
-	if (sym_name_len % 2) e->symbol_names[e->symbol_names_len-1] = '\0';
-
-	edh_add(e->hsymbol, sym_name, e->symbol + e->symbol_count);
+	res = emelf_section_add(e, EMELF_SEC_SEGMENT);
+	if (res != EMELF_E_OK) {
+		ea_free(e->alloc, seg->data, size * SIZE_WORD);
+		return res;
+	}
 
-	e->symbol_count++;
+	if (size) {
+		memcpy(seg->data, data, size * SIZE_WORD);
+	}
+	seg->id = id;
+	seg->addr = addr;
+	seg->size = size;
+	e->segment_count++;
 
-	return e->symbol_count-1;
+	return EMELF_E_OK;
 }
 
 // -----------------------------------------------------------------------
-struct emelf_symbol * emelf_symbol_get(struct emelf *e, char *sym_name)
+int emelf_regs_set(struct emelf *e, const uint16_t *regs, unsigned count)
 {
-	return edh_get(e->hsymbol, sym_name);
-}
+	assert(e);
 
-// -----------------------------------------------------------------------
-struct emelf * emelf_load(FILE *f)
-{
 	int i;
 	int res;
 
-	struct emelf *e = calloc(1, SIZE_EMELF);
-	if (!e) {
-		emelf_errno = EMELF_E_ALLOC;
-		goto cleanup;
+	if (e->map) {
+		return EMELF_E_RDONLY;
 	}
 
-	// load header
-	res = fread(e, EMELF_MAGIC_LEN, 1, f);
-	if (res < 0) {
-		emelf_errno = EMELF_E_FREAD;
-		goto cleanup;
-	}
-	res = nfread((char*)e + EMELF_MAGIC_LEN, SIZE_HEADER - EMELF_MAGIC_LEN, 1, f);
-	if (res < 0) {
-		emelf_errno = EMELF_E_FREAD;
-		goto cleanup;
+	res = emelf_lazy_load(e, 1 << EMELF_SEC_REGS);
+	if (res != EMELF_E_OK) {
+		return res;
 	}
 
-	// header checks
-	if (strncmp(e->eh.magic, EMELF_MAGIC, EMELF_MAGIC_LEN)) {
-		emelf_errno = EMELF_E_MAGIC;
-		goto cleanup;
-	}
-	if (e->eh.version != EMELF_VER) {
-		emelf_errno = EMELF_E_VERSION;
-		goto cleanup;
+	// there is only one register set
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+		if (e->section[i].type == EMELF_SEC_REGS) {
+			break;
+		}
 	}
-	if ((e->eh.abi <= EMELF_ABI_UNKNOWN) || (e->eh.abi >= EMELF_ABI_MAX)) {
-		emelf_errno = EMELF_E_ABI;
-		goto cleanup;
+	if (i >= e->eh.sec_count) {
+		res = emelf_section_add(e, EMELF_SEC_REGS);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
 	}
-	if ((e->eh.cpu <= EMELF_CPU_UNKNOWN) || (e->eh.cpu >= EMELF_CPU_MAX)) {
-		emelf_errno = EMELF_E_CPU;
-		goto cleanup;
+
+	uint16_t *r = ea_realloc(e->alloc, e->regs, e->reg_count * SIZE_WORD, count * SIZE_WORD);
+	if (!r && count) {
+		return EMELF_E_ALLOC;
 	}
-	if ((e->eh.type <= EMELF_UNKNOWN) || (e->eh.type >= EMELF_TYPE_MAX)) {
-		emelf_errno = EMELF_E_TYPE;
-		goto cleanup;
+	if (count) {
+		memcpy(r, regs, count * SIZE_WORD);
 	}
+	e->regs = r;
+	e->reg_count = count;
 
-	// load section list
-	e->section = malloc(SIZE_SECTION * e->eh.sec_count);
-	if (!e->section) {
-		emelf_errno = EMELF_E_ALLOC;
-		goto cleanup;
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_symbol_hash_build(struct emelf *e)
+{
+	int i;
+	struct edh_table *expected = NULL;
+
+	struct edh_table *dh = edh_create(e, e->symbol_count);
+	if (!dh) {
+		return EMELF_E_ALLOC;
 	}
 
-	int section_hdr = ((int) (e->eh.sec_header_hi) << 16) + e->eh.sec_header_lo;
-	res = fseek(f, section_hdr, SEEK_SET);
-	if (res < 0) {
-		emelf_errno = EMELF_E_FREAD;
-		goto cleanup;
+	for (i=0 ; i<e->symbol_count ; i++) {
+		if (edh_add(dh, i) < 0) {
+			edh_destroy(dh);
+			return EMELF_E_ALLOC;
+		}
 	}
-	res = nfread(e->section, SIZE_SECTION, e->eh.sec_count, f);
-	if (res < 0) {
-		emelf_errno = EMELF_E_FREAD;
-		goto cleanup;
+
+	// threads doing first lookups on a shared object may race here,
+	// only one table gets published
+	if (!__atomic_compare_exchange_n(&e->hsymbol, &expected, dh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		edh_destroy(dh);
 	}
 
-	// load sections
-	for (i=0 ; i<e->eh.sec_count ; i++) {
+	return EMELF_E_OK;
+}
 
-		struct emelf_section *sec = e->section + i;
+// -----------------------------------------------------------------------
+static int emelf_symbol_prepare(struct emelf *e)
+{
+	int res;
 
-		fseek(f, sec->offset, SEEK_SET);
+	if (e->map) {
+		return EMELF_E_RDONLY;
+	}
 
-		switch (sec->type) {
-			case EMELF_SEC_IMAGE:
-				res = nfread(e->image, SIZE_WORD, sec->size, f);
-				e->image_size = res;
-				break;
-			case EMELF_SEC_RELOC:
-				e->reloc = malloc(SIZE_RELOC * sec->size);
-				res = nfread(e->reloc, SIZE_RELOC, sec->size, f);
-				e->reloc_count = e->reloc_slots = res;
-				break;
-			case EMELF_SEC_SYM:
-				e->symbol = malloc(SIZE_SYMBOL * sec->size);
-				res = nfread(e->symbol, SIZE_SYMBOL, sec->size, f);
-				e->symbol_count = e->symbol_slots = res;
-				break;
-			case EMELF_SEC_SYM_NAMES:
-				e->symbol_names = malloc(SIZE_CHAR * sec->size);
-				res = fread(e->symbol_names, SIZE_CHAR, sec->size, f);
-				e->symbol_names_len = e->symbol_names_space = res;
-				break;
-			case EMELF_SEC_DEBUG:
-				res = 0;
-				break;
-			case EMELF_SEC_IDENT:
-				res = 0;
-				break;
-			default:
-				res = 0;
-				emelf_errno = EMELF_E_SECTION;
-				goto cleanup;
+	res = emelf_lazy_load(e, 1 << EMELF_SEC_SYM);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	// add symbol sections and hash if none
+	if (!e->symbol_slots) {
+		res = emelf_section_add(e, EMELF_SEC_SYM);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+		res = emelf_section_add(e, EMELF_SEC_SYM_NAMES);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+		res = emelf_section_add(e, EMELF_SEC_SYM_HASH);
+		if (res != EMELF_E_OK) {
+			return res;
 		}
+	}
 
-		if (res < 0) {
-			emelf_errno = EMELF_E_FREAD;
-			goto cleanup;
+	// objects loaded without a hash index get it built now
+	if (!e->hsymbol) {
+		res = emelf_symbol_hash_build(e);
+		if (res != EMELF_E_OK) {
+			return res;
 		}
 	}
 
-	// update symbol hash
-	if (e->symbol_slots) {
-		e->hsymbol = edh_create(16000);
-		for (i=0 ; i<e->symbol_count ; i++) {
-			edh_add(e->hsymbol, e->symbol_names + e->symbol[i].offset, e->symbol + i);
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_symbol_reserve(struct emelf *e, unsigned count, unsigned names)
+{
+	if (e->symbol_count + count > e->symbol_slots) {
+		unsigned slots = emelf_grow(e->symbol_slots, e->symbol_count + count);
+		struct emelf_symbol *symbol = ea_realloc(e->alloc, e->symbol, e->symbol_slots * SIZE_SYMBOL, slots * SIZE_SYMBOL);
+		if (!symbol) {
+			return EMELF_E_ALLOC;
 		}
+		e->symbol = symbol;
+		e->symbol_slots = slots;
 	}
 
-	return e;
+	if (e->symbol_names_len + names >= e->symbol_names_space) {
+		unsigned space = emelf_grow(e->symbol_names_space, e->symbol_names_len + names + 1);
+		char *symbol_names = ea_realloc(e->alloc, e->symbol_names, e->symbol_names_space, space);
+		if (!symbol_names) {
+			return EMELF_E_ALLOC;
+		}
+		e->symbol_names = symbol_names;
+		e->symbol_names_space = space;
+	}
 
-cleanup:
-	free(e);
-	return NULL;
+	return EMELF_E_OK;
 }
 
 // -----------------------------------------------------------------------
-int emelf_header_write(struct emelf *e, FILE *f)
+static int emelf_symbol_store(struct emelf *e, unsigned flags, const char *sym_name, uint16_t value)
 {
-	assert(e);
-
 	int res;
-	
-	rewind(f);
+	int idx;
+	unsigned hash = edh_hash(sym_name);
 
-	res = fwrite(e, EMELF_MAGIC_LEN, 1, f);
-	if (res < 0) {
-		return EMELF_E_FWRITE;
+	// if symbol is defined, return its index
+	idx = edh_lookup(e->hsymbol, sym_name, hash);
+	if (idx >= 0) {
+		return idx;
 	}
 
-	res = nfwrite((char*)e + EMELF_MAGIC_LEN, SIZE_HEADER - EMELF_MAGIC_LEN, 1, f);
-	if (res < 0) {
-		return EMELF_E_FWRITE;
+	// symbol count and name offsets are 16-bit
+	if ((e->symbol_count >= 65535) || (e->symbol_names_len > 65535)) {
+		return -EMELF_E_COUNT;
 	}
 
-	return EMELF_E_OK;
+	// pad symbol names to 16-bit
+	int sym_name_len = strlen(sym_name) + 1;
+	int sym_name_pad = sym_name_len % 2;
+	sym_name_len += sym_name_pad;
+
+	res = emelf_symbol_reserve(e, 1, sym_name_len);
+	if (res != EMELF_E_OK) {
+		return -res;
+	}
+
+	struct emelf_symbol *s = e->symbol + e->symbol_count;
+
+	// store symbol
+	s->flags = flags;
+	s->offset = e->symbol_names_len;
+	s->value = value;
+
+	// store symbol name (and pad)
+	strcpy(e->symbol_names + e->symbol_names_len, sym_name);
+	e->symbol_names_len += sym_name_len;
+	if (sym_name_pad) e->symbol_names[e->symbol_names_len-1] = '\0';
+
+	if (edh_insert(e->hsymbol, e->symbol_count, hash) < 0) {
+		e->symbol_names_len -= sym_name_len;
+		return -EMELF_E_ALLOC;
+	}
+
+	return e->symbol_count++;
 }
 
 // -----------------------------------------------------------------------
-int emelf_write(struct emelf *e, FILE *f)
+int emelf_symbol_add(struct emelf *e, unsigned flags, char *sym_name, uint16_t value)
 {
 	assert(e);
 
-	int i;
-	int res = 0;
+	int res;
+	int idx;
 
-	// write header
-	res = emelf_header_write(e, f);
+	res = emelf_symbol_prepare(e);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		return -1;
+	}
+
+	int symbol_count = e->symbol_count;
+	idx = emelf_symbol_store(e, flags, sym_name, value);
+	if (idx < 0) {
+		emelf_seterr(-idx);
+		return -1;
+	}
+
+	// address index is rebuilt on next address lookup
+	if (e->symbol_count != symbol_count) {
+		eaddr_destroy(e->haddr);
+		e->haddr = NULL;
+	}
+
+	return idx;
+}
+
+// -----------------------------------------------------------------------
+int emelf_symbols_add(struct emelf *e, const struct emelf_symbol_def *sym, int count, int *idx)
+{
+	assert(e);
+	assert(sym || (count <= 0));
+
+	int i;
+	int res;
+	int symbol_count = e->symbol_count;
+	unsigned names = 0;
+
+	res = emelf_symbol_prepare(e);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	// size everything for the worst case (no duplicates) up front,
+	// within format limits
+	for (i=0 ; i<count ; i++) {
+		names += (strlen(sym[i].name) + 2) & ~1;
+		if (names > 65536) {
+			names = 65536;
+		}
+	}
+	unsigned reserve = count;
+	if (reserve > 65535 - e->symbol_count) {
+		reserve = 65535 - e->symbol_count;
+	}
+	res = emelf_symbol_reserve(e, reserve, names);
+	if ((res == EMELF_E_OK) && (edh_reserve(e->hsymbol, e->symbol_count + reserve) < 0)) {
+		res = EMELF_E_ALLOC;
+	}
+
+	// symbols already defined (or repeated) are not added again
+	for (i=0 ; (i<count) && (res == EMELF_E_OK) ; i++) {
+		int n = emelf_symbol_store(e, sym[i].flags, sym[i].name, sym[i].value);
+		if (n < 0) {
+			res = -n;
+		} else if (idx) {
+			idx[i] = n;
+		}
+	}
+
+	if (e->symbol_count != symbol_count) {
+		eaddr_destroy(e->haddr);
+		e->haddr = NULL;
+	}
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+struct emelf_symbol * emelf_symbol_get(struct emelf *e, char *sym_name)
+{
+	if (emelf_lazy_load(e, 1 << EMELF_SEC_SYM) != EMELF_E_OK) {
+		return NULL;
+	}
+
+	// build hash index on first lookup if object didn't come with one
+	if (!__atomic_load_n(&e->hsymbol, __ATOMIC_ACQUIRE) && e->symbol_count) {
+		int res = emelf_symbol_hash_build(e);
+		if (res != EMELF_E_OK) {
+			emelf_seterr(res);
+			return NULL;
+		}
+	}
+
+	int idx = edh_get(__atomic_load_n(&e->hsymbol, __ATOMIC_ACQUIRE), sym_name);
+	if (idx < 0) {
+		return NULL;
+	}
+
+	return e->symbol + idx;
+}
+
+// -----------------------------------------------------------------------
+int emelf_hash_stats(struct emelf *e, struct emelf_hash_stats *hs)
+{
+	assert(e);
+	assert(hs);
+
+	int res = emelf_lazy_load(e, 1 << EMELF_SEC_SYM);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	// report the index lookups would use
+	if (!__atomic_load_n(&e->hsymbol, __ATOMIC_ACQUIRE) && e->symbol_count) {
+		res = emelf_symbol_hash_build(e);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+	}
+
+	edh_stats(__atomic_load_n(&e->hsymbol, __ATOMIC_ACQUIRE), hs);
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_symbol_names_check(struct emelf *e)
+{
+	int i;
+	unsigned last = 0;
+
+	if (!e->symbol_count) {
+		return EMELF_E_OK;
+	}
+
+	// make sure all names end inside the names section
+	// (if the name at the highest offset is terminated, all of them are)
+	for (i=0 ; i<e->symbol_count ; i++) {
+		if (e->symbol[i].offset > last) {
+			last = e->symbol[i].offset;
+		}
+	}
+	if ((last >= e->symbol_names_len) || !memchr(e->symbol_names + last, '\0', e->symbol_names_len - last)) {
+		return EMELF_E_SECTION;
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_header_check(struct emelf_header *eh)
+{
+	if (strncmp(eh->magic, EMELF_MAGIC, EMELF_MAGIC_LEN)) {
+		return EMELF_E_MAGIC;
+	}
+	if (eh->version > EMELF_VER) {
+		return EMELF_E_VERSION;
+	}
+	if ((eh->abi <= EMELF_ABI_UNKNOWN) || (eh->abi >= EMELF_ABI_MAX)) {
+		return EMELF_E_ABI;
+	}
+	if ((eh->cpu <= EMELF_CPU_UNKNOWN) || (eh->cpu >= EMELF_CPU_MAX)) {
+		return EMELF_E_CPU;
+	}
+	if ((eh->type <= EMELF_UNKNOWN) || (eh->type >= EMELF_TYPE_MAX)) {
+		return EMELF_E_TYPE;
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_header_read(const struct emelf_io *io, void *ctx, struct emelf_header *eh)
+{
+	if (io->read(ctx, eh, SIZE_HEADER) != SIZE_HEADER) {
+		return EMELF_E_FREAD;
+	}
+	antohs((uint16_t*) ((char*) eh + EMELF_MAGIC_LEN), (SIZE_HEADER - EMELF_MAGIC_LEN) / SIZE_WORD);
+
+	return emelf_header_check(eh);
+}
+
+// -----------------------------------------------------------------------
+static unsigned emelf_section_disk_size(unsigned version)
+{
+	return version ? SIZE_SECTION_V1 : SIZE_SECTION_V0;
+}
+
+// -----------------------------------------------------------------------
+static void emelf_section_list_decode(struct emelf_section *sec, const uint16_t *w, unsigned count, unsigned version)
+{
+	unsigned i;
+
+	for (i=0 ; i<count ; i++) {
+		sec[i].type = w[0];
+		if (version) {
+			sec[i].offset = ((uint32_t) w[1] << 16) + w[2];
+			sec[i].size = ((uint32_t) w[3] << 16) + w[4];
+			w += SIZE_SECTION_V1 / SIZE_WORD;
+		} else {
+			sec[i].offset = w[1];
+			sec[i].size = w[2];
+			w += SIZE_SECTION_V0 / SIZE_WORD;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+static int emelf_section_list_read(const struct emelf_io *io, void *ctx, unsigned version, struct emelf_section *sec, unsigned count)
+{
+	uint16_t chunk[NWRITE_CHUNK];
+	unsigned size = emelf_section_disk_size(version);
+	unsigned i = 0;
+
+	while (i < count) {
+		unsigned len = count - i;
+		if (len > sizeof(chunk) / size) {
+			len = sizeof(chunk) / size;
+		}
+		if (nread(io, ctx, chunk, size, len) < 0) {
+			return EMELF_E_FREAD;
+		}
+		emelf_section_list_decode(sec + i, chunk, len, version);
+		i += len;
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int emelf_probe_io(const struct emelf_io *io, void *ctx, struct emelf_info *info)
+{
+	assert(info);
+
+	int res;
+	unsigned i;
+	struct emelf_section chunk[256];
+	struct emelf_section image = { EMELF_SEC_UNKNOWN, 0, 0 };
+
+	memset(info, 0, sizeof(struct emelf_info));
+
+	res = emelf_header_read(io, ctx, &info->eh);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	unsigned section_hdr = ((unsigned) (info->eh.sec_header_hi) << 16) + info->eh.sec_header_lo;
+	if (io->seek(ctx, section_hdr) < 0) {
+		return EMELF_E_FREAD;
+	}
+
+	// sum up section sizes, section contents are never read
+	for (i=0 ; i<info->eh.sec_count ; ) {
+		unsigned j;
+		unsigned len = info->eh.sec_count - i;
+		if (len > sizeof(chunk) / SIZE_SECTION) {
+			len = sizeof(chunk) / SIZE_SECTION;
+		}
+		res = emelf_section_list_read(io, ctx, info->eh.version, chunk, len);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+		for (j=0 ; j<len ; j++) {
+			if ((chunk[j].type <= EMELF_SEC_UNKNOWN) || (chunk[j].type >= EMELF_SEC_MAX)) {
+				return EMELF_E_SECTION;
+			}
+			info->sec_size[chunk[j].type] += chunk[j].size;
+			if (chunk[j].type == EMELF_SEC_IMAGE) {
+				image = chunk[j];
+			}
+		}
+		i += len;
+	}
+
+	// encoded image size is not the image size, read the decoded one
+	if ((info->eh.flags & EMELF_FLAG_IMAGE_RLE) && image.type) {
+		uint16_t hdr[2];
+		if ((image.size < 2) || (io->seek(ctx, image.offset) < 0) || (nread(io, ctx, hdr, SIZE_WORD, 2) < 0)) {
+			return EMELF_E_FREAD;
+		}
+		info->sec_size[EMELF_SEC_IMAGE] = ((unsigned) hdr[0] << 16) + hdr[1];
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int emelf_probe(FILE *f, struct emelf_info *info)
+{
+	return emelf_probe_io(&emelf_io_stdio, f, info);
+}
+
+// -----------------------------------------------------------------------
+static void emelf_symbol_hash_import(struct emelf *e, struct edh_slot *slots, struct emelf_hash_slot *hs, unsigned size)
+{
+	// unusable index is not an error, it gets rebuilt on first use
+	e->hsymbol = edh_import(e, slots, hs, size);
+	if (!e->hsymbol) {
+		ea_free(e->alloc, slots, size * sizeof(struct edh_slot));
+	}
+}
+
+// -----------------------------------------------------------------------
+static int emelf_image_rle_alloc(struct emelf *e, const uint16_t *hdr, unsigned stored)
+{
+	unsigned size = ((unsigned) hdr[0] << 16) + hdr[1];
+
+	if (e->image || (stored < 2) || (size > e->amax)) {
+		return EMELF_E_SECTION;
+	}
+	e->image = ea_alloc(e->alloc, SIZE_WORD * size);
+	if (!e->image && size) {
+		return EMELF_E_ALLOC;
+	}
+	e->image_size = e->image_slots = size;
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_image_rle_read(struct emelf *e, const struct emelf_io *io, void *ctx, struct emelf_section *sec)
+{
+	int res;
+	uint16_t chunk[NWRITE_CHUNK];
+	struct erle_dec d;
+	unsigned pos = 2;
+
+	// decoded size goes first, encoded records are decoded into the image chunk by chunk
+	if ((sec->size < 2) || (nread(io, ctx, chunk, SIZE_WORD, 2) < 0)) {
+		return EMELF_E_FREAD;
+	}
+	res = emelf_image_rle_alloc(e, chunk, sec->size);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	erle_dec_init(&d, e->image, e->image_size);
+	while (pos < sec->size) {
+		unsigned len = sec->size - pos;
+		if (len > NWRITE_CHUNK) {
+			len = NWRITE_CHUNK;
+		}
+		if (nread(io, ctx, chunk, SIZE_WORD, len) < 0) {
+			return EMELF_E_FREAD;
+		}
+		if (erle_decode(&d, chunk, len) < 0) {
+			return EMELF_E_SECTION;
+		}
+		pos += len;
+	}
+
+	return erle_dec_done(&d) < 0 ? EMELF_E_SECTION : EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_section_read_data(struct emelf *e, const struct emelf_io *io, void *ctx, struct emelf_section *sec)
+{
+	int res;
+	const struct emelf_allocator *a = e->alloc;
+
+	if (io->seek(ctx, sec->offset) < 0) {
+		return EMELF_E_FREAD;
+	}
+
+	switch (sec->type) {
+		case EMELF_SEC_IMAGE:
+			if (e->eh.flags & EMELF_FLAG_IMAGE_RLE) {
+				return emelf_image_rle_read(e, io, ctx, sec);
+			}
+			if (e->image || (sec->size > e->amax)) {
+				return EMELF_E_SECTION;
+			}
+			e->image = ea_alloc(a, SIZE_WORD * sec->size);
+			if (!e->image) {
+				return EMELF_E_ALLOC;
+			}
+			e->image_size = e->image_slots = sec->size;
+			res = nread(io, ctx, e->image, SIZE_WORD, sec->size);
+			break;
+		case EMELF_SEC_RELOC:
+			if (e->reloc) {
+				return EMELF_E_SECTION;
+			}
+			e->reloc = ea_alloc(a, SIZE_RELOC * sec->size);
+			if (!e->reloc) {
+				return EMELF_E_ALLOC;
+			}
+			e->reloc_count = e->reloc_slots = sec->size;
+			res = nread(io, ctx, e->reloc, SIZE_RELOC, sec->size);
+			break;
+		case EMELF_SEC_SYM:
+			if (e->symbol) {
+				return EMELF_E_SECTION;
+			}
+			e->symbol = ea_alloc(a, SIZE_SYMBOL * sec->size);
+			if (!e->symbol) {
+				return EMELF_E_ALLOC;
+			}
+			e->symbol_count = e->symbol_slots = sec->size;
+			res = nread(io, ctx, e->symbol, SIZE_SYMBOL, sec->size);
+			break;
+		case EMELF_SEC_SYM_NAMES:
+			if (e->symbol_names) {
+				return EMELF_E_SECTION;
+			}
+			e->symbol_names = ea_alloc(a, SIZE_CHAR * sec->size);
+			if (!e->symbol_names) {
+				return EMELF_E_ALLOC;
+			}
+			e->symbol_names_len = e->symbol_names_space = sec->size;
+			res = io->read(ctx, e->symbol_names, SIZE_CHAR * sec->size) == sec->size ? 0 : -1;
+			break;
+		case EMELF_SEC_SEGMENT: {
+			uint16_t hdr[EMELF_SEGMENT_HDR];
+			struct emelf_segment *seg = e->segment + e->segment_count;
+			if ((sec->size < EMELF_SEGMENT_HDR) || (e->segment_count >= e->segment_slots)) {
+				return EMELF_E_SECTION;
+			}
+			if (nread(io, ctx, hdr, SIZE_WORD, EMELF_SEGMENT_HDR) < 0) {
+				return EMELF_E_FREAD;
+			}
+			seg->size = sec->size - EMELF_SEGMENT_HDR;
+			seg->data = ea_alloc(a, SIZE_WORD * seg->size);
+			if (!seg->data && seg->size) {
+				return EMELF_E_ALLOC;
+			}
+			seg->id = hdr[0];
+			seg->addr = ((uint32_t) hdr[1] << 16) + hdr[2];
+			e->segment_count++;
+			res = nread(io, ctx, seg->data, SIZE_WORD, seg->size);
+			break;
+		}
+		case EMELF_SEC_REGS:
+			if (e->regs) {
+				return EMELF_E_SECTION;
+			}
+			e->regs = ea_alloc(a, SIZE_WORD * sec->size);
+			if (!e->regs && sec->size) {
+				return EMELF_E_ALLOC;
+			}
+			e->reg_count = sec->size;
+			res = nread(io, ctx, e->regs, SIZE_WORD, sec->size);
+			break;
+		case EMELF_SEC_DEBUG:
+		case EMELF_SEC_IDENT:
+		case EMELF_SEC_SYM_HASH:
+			res = 0;
+			break;
+		default:
+			return EMELF_E_SECTION;
+	}
+
+	if (res < 0) {
+		return EMELF_E_FREAD;
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_section_read(struct emelf *e, const struct emelf_io *io, void *ctx, struct emelf_section *sec)
+{
+	uint64_t start = estats_start();
+
+	int res = emelf_section_read_data(e, io, ctx, sec);
+	if (res == EMELF_E_OK) {
+		estats_section(e, sec->type, EMELF_STAT_READ, (uint64_t) sec->size * emelf_section_elem_size(sec->type), start);
+	}
+
+	return res;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_hash_read(struct emelf *e, const struct emelf_io *io, void *ctx, struct emelf_section *sec)
+{
+	if (!sec->size || !e->symbol_count) {
+		return EMELF_E_OK;
+	}
+
+	uint64_t start = estats_start();
+
+	// read packed slots into the beginning of slot array, expand there
+	struct edh_slot *slots = ea_alloc(e->alloc, sec->size * sizeof(struct edh_slot));
+	if (!slots) {
+		return EMELF_E_ALLOC;
+	}
+	if ((io->seek(ctx, sec->offset) < 0) || (nread(io, ctx, slots, SIZE_HASH_SLOT, sec->size) < 0)) {
+		ea_free(e->alloc, slots, sec->size * sizeof(struct edh_slot));
+		return EMELF_E_FREAD;
+	}
+	emelf_symbol_hash_import(e, slots, (struct emelf_hash_slot*) slots, sec->size);
+	estats_section(e, sec->type, EMELF_STAT_READ, (uint64_t) sec->size * SIZE_HASH_SLOT, start);
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_segment_sections(struct emelf *e)
+{
+	int i;
+	int count = 0;
+
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+		count += e->section[i].type == EMELF_SEC_SEGMENT;
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_sections_read(struct emelf *e, const struct emelf_io *io, void *ctx, unsigned types)
+{
+	int i;
+	int res;
+	struct emelf_section *hash_sec = NULL;
+
+	if (types & (1 << EMELF_SEC_SEGMENT)) {
+		res = emelf_segment_alloc(e, emelf_segment_sections(e));
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+	}
+
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+		struct emelf_section *sec = e->section + i;
+		if (!(types & (1 << sec->type))) {
+			continue;
+		}
+		if (sec->type == EMELF_SEC_SYM_HASH) {
+			// needs symbols, loaded when all other sections are in
+			hash_sec = sec;
+			continue;
+		}
+		res = emelf_section_read(e, io, ctx, sec);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+	}
+
+	if (types & ((1 << EMELF_SEC_SYM) | (1 << EMELF_SEC_SYM_NAMES))) {
+		res = emelf_symbol_names_check(e);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+	}
+
+	if (hash_sec) {
+		return emelf_hash_read(e, io, ctx, hash_sec);
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static struct emelf * emelf_load_internal(const struct emelf_io *io, void *ctx, const struct emelf_allocator *a, int lazy)
+{
+	int i;
+	int res;
+	unsigned types = 0;
+
+	if (!a) {
+		a = &emelf_allocator_malloc;
+	}
+
+	struct emelf *e = ea_zalloc(a, SIZE_EMELF);
+	if (!e) {
+		emelf_seterr(EMELF_E_ALLOC);
+		goto cleanup;
+	}
+	e->alloc = a;
+	estats_attach(e);
+
+	// load header
+	res = emelf_header_read(io, ctx, &e->eh);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		goto cleanup;
+	}
+	e->amax = emelf_amax(e->eh.cpu);
+
+	// load section list
+	e->section = ea_alloc(a, SIZE_SECTION * e->eh.sec_count);
+	if (!e->section) {
+		emelf_seterr(EMELF_E_ALLOC);
+		goto cleanup;
+	}
+	e->section_slots = e->eh.sec_count;
+
+	unsigned section_hdr = ((unsigned) (e->eh.sec_header_hi) << 16) + e->eh.sec_header_lo;
+	res = io->seek(ctx, section_hdr);
+	if (res < 0) {
+		emelf_seterr(EMELF_E_FREAD);
+		goto cleanup;
+	}
+	res = emelf_section_list_read(io, ctx, e->eh.version, e->section, e->eh.sec_count);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		goto cleanup;
+	}
+
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+		if ((e->section[i].type <= EMELF_SEC_UNKNOWN) || (e->section[i].type >= EMELF_SEC_MAX)) {
+			emelf_seterr(EMELF_E_SECTION);
+			goto cleanup;
+		}
+		types |= 1 << e->section[i].type;
+	}
+
+	// lazy objects get only the image now, the rest is loaded on first use
+	if (lazy) {
+		e->lazy_io = io;
+		e->lazy_ctx = ctx;
+		e->lazy_pending = types & ~(1 << EMELF_SEC_IMAGE);
+		types &= 1 << EMELF_SEC_IMAGE;
+	}
+
+	res = emelf_sections_read(e, io, ctx, types);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		goto cleanup;
+	}
+
+	return e;
+
+cleanup:
+	emelf_destroy(e);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_load_io_a(const struct emelf_io *io, void *ctx, const struct emelf_allocator *a)
+{
+	return emelf_load_internal(io, ctx, a, 0);
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_load_lazy(const struct emelf_io *io, void *ctx, const struct emelf_allocator *a)
+{
+	return emelf_load_internal(io, ctx, a, 1);
+}
+
+// -----------------------------------------------------------------------
+static int emelf_lazy_load(struct emelf *e, unsigned types)
+{
+	int res;
+	const unsigned sym_types = (1 << EMELF_SEC_SYM) | (1 << EMELF_SEC_SYM_NAMES) | (1 << EMELF_SEC_SYM_HASH);
+
+	types &= e->lazy_pending;
+	if (!types) {
+		return EMELF_E_OK;
+	}
+
+	// symbols are checked against names and hash index needs both
+	if (types & sym_types) {
+		types |= e->lazy_pending & sym_types;
+	}
+
+	res = emelf_sections_read(e, e->lazy_io, e->lazy_ctx, types);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		return res;
+	}
+
+	e->lazy_pending &= ~types;
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int emelf_section_load(struct emelf *e, int type)
+{
+	assert(e);
+
+	if ((type <= EMELF_SEC_UNKNOWN) || (type >= EMELF_SEC_MAX)) {
+		return EMELF_E_SECTION;
+	}
+
+	return emelf_lazy_load(e, 1 << type);
+}
+
+// -----------------------------------------------------------------------
+int emelf_sections_load(struct emelf *e)
+{
+	assert(e);
+
+	return emelf_lazy_load(e, e->lazy_pending);
+}
+
+// -----------------------------------------------------------------------
+struct emelf_reloc * emelf_relocs(struct emelf *e)
+{
+	if (emelf_section_load(e, EMELF_SEC_RELOC) != EMELF_E_OK) {
+		return NULL;
+	}
+
+	return e->reloc;
+}
+
+// -----------------------------------------------------------------------
+struct emelf_symbol * emelf_symbols(struct emelf *e)
+{
+	if (emelf_section_load(e, EMELF_SEC_SYM) != EMELF_E_OK) {
+		return NULL;
+	}
+
+	return e->symbol;
+}
+
+// -----------------------------------------------------------------------
+char * emelf_symbol_names(struct emelf *e)
+{
+	if (emelf_section_load(e, EMELF_SEC_SYM_NAMES) != EMELF_E_OK) {
+		return NULL;
+	}
+
+	return e->symbol_names;
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_load_io(const struct emelf_io *io, void *ctx)
+{
+	return emelf_load_io_a(io, ctx, NULL);
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_load(FILE *f)
+{
+	return emelf_load_io(&emelf_io_stdio, f);
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_load_mem(const void *buf, size_t size)
+{
+	struct emelf_membuf mb = {
+		.buf = (void*) buf,
+		.size = size,
+		.pos = 0,
+	};
+
+	return emelf_load_io(&emelf_io_mem, &mb);
+}
+
+// -----------------------------------------------------------------------
+static void * emelf_map_view(struct emelf *e, unsigned offset, unsigned size)
+{
+	// views are accessed as 16-bit words, so they need to be aligned
+	if ((offset & 1) || (offset > e->map_size) || (size > e->map_size - offset)) {
+		return NULL;
+	}
+
+	return (char*) e->map + offset;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_image_rle_map(struct emelf *e, const uint16_t *view, unsigned stored)
+{
+	int res;
+	struct erle_dec d;
+
+	res = emelf_image_rle_alloc(e, view, stored);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	erle_dec_init(&d, e->image, e->image_size);
+	if ((erle_decode(&d, view + 2, stored - 2) < 0) || (erle_dec_done(&d) < 0)) {
+		return EMELF_E_SECTION;
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_map(const char *path)
+{
+	int i;
+	int res;
+	int fd;
+	struct stat st;
+	void *map;
+	struct emelf *e = NULL;
+	struct emelf_hash_slot *hash_slots = NULL;
+	unsigned hash_size = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		emelf_seterr(EMELF_E_FREAD);
+		return NULL;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t) SIZE_HEADER)) {
+		close(fd);
+		emelf_seterr(EMELF_E_FREAD);
+		return NULL;
+	}
+
+	// Mapping is private and writable: big-endian data is decoded in place
+	// in one pass. Pages stay shared with the page cache until touched,
+	// which on big-endian hosts means never.
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		emelf_seterr(EMELF_E_FREAD);
+		return NULL;
+	}
+
+	e = ea_zalloc(&emelf_allocator_malloc, SIZE_EMELF);
+	if (!e) {
+		munmap(map, st.st_size);
+		emelf_seterr(EMELF_E_ALLOC);
+		return NULL;
+	}
+	e->alloc = &emelf_allocator_malloc;
+	e->map = map;
+	e->map_size = st.st_size;
+	estats_attach(e);
+
+	// decode header
+	memcpy(&e->eh, map, SIZE_HEADER);
+	antohs((uint16_t*) ((char*) &e->eh + EMELF_MAGIC_LEN), (SIZE_HEADER - EMELF_MAGIC_LEN) / SIZE_WORD);
+
+	res = emelf_header_check(&e->eh);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		goto cleanup;
+	}
+	e->amax = emelf_amax(e->eh.cpu);
+
+	// section list
+	unsigned section_hdr = ((unsigned) (e->eh.sec_header_hi) << 16) + e->eh.sec_header_lo;
+	unsigned section_list_size = emelf_section_disk_size(e->eh.version) * e->eh.sec_count;
+	uint16_t *section_list = emelf_map_view(e, section_hdr, section_list_size);
+	if (!section_list) {
+		emelf_seterr(EMELF_E_SECTION);
+		goto cleanup;
+	}
+	antohs(section_list, section_list_size / SIZE_WORD);
+	e->section = ea_alloc(e->alloc, SIZE_SECTION * e->eh.sec_count);
+	if (!e->section) {
+		emelf_seterr(EMELF_E_ALLOC);
+		goto cleanup;
+	}
+	e->section_slots = e->eh.sec_count;
+	emelf_section_list_decode(e->section, section_list, e->eh.sec_count, e->eh.version);
+
+	res = emelf_segment_alloc(e, emelf_segment_sections(e));
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		goto cleanup;
+	}
+
+	// section views
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+
+		struct emelf_section *sec = e->section + i;
+		void *view;
+		uint64_t start = estats_start();
+
+		switch (sec->type) {
+			case EMELF_SEC_IMAGE:
+				view = emelf_map_view(e, sec->offset, SIZE_WORD * sec->size);
+				if (e->eh.flags & EMELF_FLAG_IMAGE_RLE) {
+					// encoded image is decoded out of the mapping
+					if (!view || (sec->size < 2)) {
+						view = NULL;
+						break;
+					}
+					antohs(view, sec->size);
+					if (emelf_image_rle_map(e, view, sec->size) != EMELF_E_OK) {
+						view = NULL;
+					}
+					break;
+				}
+				if (!view || e->image || (sec->size > e->amax)) {
+					view = NULL;
+					break;
+				}
+				antohs(view, sec->size);
+				e->image = view;
+				e->image_size = sec->size;
+				break;
+			case EMELF_SEC_RELOC:
+				view = emelf_map_view(e, sec->offset, SIZE_RELOC * sec->size);
+				if (!view) {
+					break;
+				}
+				antohs(view, SIZE_RELOC * sec->size / SIZE_WORD);
+				e->reloc = view;
+				e->reloc_count = sec->size;
+				break;
+			case EMELF_SEC_SYM:
+				view = emelf_map_view(e, sec->offset, SIZE_SYMBOL * sec->size);
+				if (!view) {
+					break;
+				}
+				antohs(view, SIZE_SYMBOL * sec->size / SIZE_WORD);
+				e->symbol = view;
+				e->symbol_count = sec->size;
+				break;
+			case EMELF_SEC_SYM_NAMES:
+				view = emelf_map_view(e, sec->offset, SIZE_CHAR * sec->size);
+				e->symbol_names = view;
+				e->symbol_names_len = sec->size;
+				break;
+			case EMELF_SEC_SEGMENT: {
+				struct emelf_segment *seg = e->segment + e->segment_count;
+				view = emelf_map_view(e, sec->offset, SIZE_WORD * sec->size);
+				if (!view || (sec->size < EMELF_SEGMENT_HDR)) {
+					view = NULL;
+					break;
+				}
+				antohs(view, sec->size);
+				seg->id = ((uint16_t*) view)[0];
+				seg->addr = ((uint32_t) ((uint16_t*) view)[1] << 16) + ((uint16_t*) view)[2];
+				seg->data = (uint16_t*) view + EMELF_SEGMENT_HDR;
+				seg->size = sec->size - EMELF_SEGMENT_HDR;
+				e->segment_count++;
+				break;
+			}
+			case EMELF_SEC_REGS:
+				view = emelf_map_view(e, sec->offset, SIZE_WORD * sec->size);
+				if (!view || e->regs) {
+					view = NULL;
+					break;
+				}
+				antohs(view, sec->size);
+				e->regs = view;
+				e->reg_count = sec->size;
+				break;
+			case EMELF_SEC_DEBUG:
+			case EMELF_SEC_IDENT:
+				view = e;
+				break;
+			case EMELF_SEC_SYM_HASH:
+				view = emelf_map_view(e, sec->offset, SIZE_HASH_SLOT * sec->size);
+				if (!view) {
+					break;
+				}
+				antohs(view, SIZE_HASH_SLOT * sec->size / SIZE_WORD);
+				hash_slots = view;
+				hash_size = sec->size;
+				break;
+			default:
+				view = NULL;
+				break;
+		}
+
+		if (!view) {
+			emelf_seterr(EMELF_E_SECTION);
+			goto cleanup;
+		}
+		estats_section(e, sec->type, EMELF_STAT_READ, (uint64_t) sec->size * emelf_section_elem_size(sec->type), start);
+	}
+
+	res = emelf_symbol_names_check(e);
+	if (res != EMELF_E_OK) {
+		emelf_seterr(res);
+		goto cleanup;
+	}
+
+	// use stored symbol hash index
+	if (hash_size && e->symbol_count) {
+		struct edh_slot *slots = ea_alloc(e->alloc, hash_size * sizeof(struct edh_slot));
+		if (!slots) {
+			emelf_seterr(EMELF_E_ALLOC);
+			goto cleanup;
+		}
+		emelf_symbol_hash_import(e, slots, hash_slots, hash_size);
+	}
+
+	return e;
+
+cleanup:
+	emelf_destroy(e);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+struct emelf * emelf_open(const char *path)
+{
+	FILE *f;
+	struct emelf *e;
+
+	e = emelf_map(path);
+	if (e) {
+		return e;
+	}
+
+	// not mappable (pipe, device, ...)
+	f = fopen(path, "r");
+	if (!f) {
+		emelf_seterr(EMELF_E_FREAD);
+		return NULL;
+	}
+	e = emelf_load(f);
+	fclose(f);
+
+	return e;
+}
+
+// -----------------------------------------------------------------------
+static long emelf_section_elems(struct emelf *e, int type, int seg)
+{
+	switch (type) {
+		case EMELF_SEC_IMAGE:
+			if (e->eh.flags & EMELF_FLAG_IMAGE_RLE) {
+				return 2 + erle_encode(e->image, e->image_size, NULL);
+			}
+			return e->image_size;
+		case EMELF_SEC_RELOC:
+			return e->reloc_count;
+		case EMELF_SEC_SYM:
+			return e->symbol_count;
+		case EMELF_SEC_SYM_NAMES:
+			return e->symbol_names_len;
+		case EMELF_SEC_SEGMENT:
+			return EMELF_SEGMENT_HDR + (long) e->segment[seg].size;
+		case EMELF_SEC_REGS:
+			return e->reg_count;
+		case EMELF_SEC_DEBUG:
+		case EMELF_SEC_IDENT:
+			return 0;
+		case EMELF_SEC_SYM_HASH:
+			// index that isn't there is left out and rebuilt by the loader
+			if (!e->hsymbol) {
+				return 0;
+			}
+			return e->hsymbol->size;
+		default:
+			return -1;
+	}
+}
+
+// -----------------------------------------------------------------------
+static int emelf_section_elem_size(int type)
+{
+	switch (type) {
+		case EMELF_SEC_IMAGE:
+		case EMELF_SEC_SEGMENT:
+		case EMELF_SEC_REGS:
+			return SIZE_WORD;
+		case EMELF_SEC_RELOC:
+			return SIZE_RELOC;
+		case EMELF_SEC_SYM:
+			return SIZE_SYMBOL;
+		case EMELF_SEC_SYM_NAMES:
+			return SIZE_CHAR;
+		case EMELF_SEC_SYM_HASH:
+			return SIZE_HASH_SLOT;
+		default:
+			return 0;
+	}
+}
+
+// -----------------------------------------------------------------------
+static long emelf_align(struct emelf *e, long pos)
+{
+	if (!e->eh.version) {
+		return pos;
+	}
+
+	return (pos + EMELF_SEC_ALIGN - 1) & ~(long) (EMELF_SEC_ALIGN - 1);
+}
+
+// -----------------------------------------------------------------------
+static long emelf_layout(struct emelf *e)
+{
+	int i;
+	int seg = 0;
+	long pos = SIZE_HEADER;
+
+	if (!e->eh.version && (e->eh.flags & EMELF_FLAG_IMAGE_RLE)) {
+		return -EMELF_E_VERSION;
+	}
+
+	// sections follow the header, section list goes last
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+		int type = e->section[i].type;
+		// version 0 readers know sections up to EMELF_SEC_IDENT only
+		if (!e->eh.version && (type > EMELF_SEC_IDENT)) {
+			return -EMELF_E_VERSION;
+		}
+		if ((type == EMELF_SEC_SEGMENT) && (seg >= e->segment_count)) {
+			return -EMELF_E_SECTION;
+		}
+		long elems = emelf_section_elems(e, type, seg);
+		if (elems < 0) {
+			return -EMELF_E_SECTION;
+		}
+		seg += type == EMELF_SEC_SEGMENT;
+		pos = emelf_align(e, pos);
+		// version 0 has only 16 bits for offsets and sizes
+		if (!e->eh.version && ((pos > 65535) || (elems > 65535))) {
+			return -EMELF_E_VERSION;
+		}
+		e->section[i].offset = pos;
+		e->section[i].size = elems;
+		pos += elems * emelf_section_elem_size(type);
+		if (pos > UINT32_MAX) {
+			return -EMELF_E_COUNT;
+		}
+	}
+
+	pos = emelf_align(e, pos);
+	if (pos > UINT32_MAX) {
+		return -EMELF_E_COUNT;
+	}
+	e->eh.sec_header_hi = pos >> 16;
+	e->eh.sec_header_lo = pos & 65535;
+
+	return pos + e->eh.sec_count * emelf_section_disk_size(e->eh.version);
+}
+
+// -----------------------------------------------------------------------
+static int emelf_pad_write(const struct emelf_io *io, void *ctx, long len)
+{
+	static const char zero[EMELF_SEC_ALIGN];
+
+	return io->write(ctx, zero, len) == len ? 0 : -1;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_section_list_write(struct emelf *e, const struct emelf_io *io, void *ctx)
+{
+	uint16_t chunk[NWRITE_CHUNK];
+	unsigned size = emelf_section_disk_size(e->eh.version);
+	unsigned i = 0;
+
+	while (i < e->eh.sec_count) {
+		unsigned j;
+		unsigned len = e->eh.sec_count - i;
+		uint16_t *w = chunk;
+		if (len > sizeof(chunk) / size) {
+			len = sizeof(chunk) / size;
+		}
+		for (j=i ; j<i+len ; j++) {
+			struct emelf_section *sec = e->section + j;
+			*w++ = sec->type;
+			if (e->eh.version) {
+				*w++ = sec->offset >> 16;
+				*w++ = sec->offset & 65535;
+				*w++ = sec->size >> 16;
+				*w++ = sec->size & 65535;
+			} else {
+				*w++ = sec->offset;
+				*w++ = sec->size;
+			}
+		}
+		if (nwrite(io, ctx, chunk, size, len) < 0) {
+			return -1;
+		}
+		i += len;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_header_write(struct emelf *e, const struct emelf_io *io, void *ctx)
+{
+	assert(e);
+
+	int res;
+
+	if (io->write(ctx, e, EMELF_MAGIC_LEN) != EMELF_MAGIC_LEN) {
+		return EMELF_E_FWRITE;
+	}
+
+	res = nwrite(io, ctx, (char*)e + EMELF_MAGIC_LEN, SIZE_HEADER - EMELF_MAGIC_LEN, 1);
+	if (res < 0) {
+		return EMELF_E_FWRITE;
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_hash_write(struct emelf *e, const struct emelf_io *io, void *ctx, unsigned size)
+{
+	struct emelf_hash_slot chunk[NWRITE_CHUNK / 3];
+	unsigned pos = 0;
+
+	while (pos < size) {
+		unsigned len = size - pos;
+		if (len > NWRITE_CHUNK / 3) {
+			len = NWRITE_CHUNK / 3;
+		}
+		edh_export(e->hsymbol, chunk, pos, len);
+		antohs((uint16_t*) chunk, len * SIZE_HASH_SLOT / SIZE_WORD);
+		if (io->write(ctx, chunk, len * SIZE_HASH_SLOT) != len * SIZE_HASH_SLOT) {
+			return -1;
+		}
+		pos += len;
+	}
+
+	return size;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_image_rle_write(struct emelf *e, const struct emelf_io *io, void *ctx, unsigned size)
+{
+	uint16_t chunk[NWRITE_CHUNK];
+	unsigned fill = 2;
+	unsigned out = 2;
+	unsigned i = 0;
+	unsigned zeros;
+	unsigned literals;
+
+	// records are gathered in a fixed-size buffer, like nwrite() does,
+	// literal runs that don't fit go straight from the image
+	chunk[0] = e->image_size >> 16;
+	chunk[1] = e->image_size & 65535;
+	while (i < e->image_size) {
+		i += erle_record(e->image + i, e->image_size - i, &zeros, &literals);
+		if (fill + 2 > NWRITE_CHUNK) {
+			if (nwrite(io, ctx, chunk, SIZE_WORD, fill) < 0) {
+				return -1;
+			}
+			fill = 0;
+		}
+		chunk[fill++] = zeros;
+		chunk[fill++] = literals;
+		out += 2 + literals;
+		if (fill + literals <= NWRITE_CHUNK) {
+			memcpy(chunk + fill, e->image + i - literals, literals * SIZE_WORD);
+			fill += literals;
+		} else if ((nwrite(io, ctx, chunk, SIZE_WORD, fill) < 0) || (nwrite(io, ctx, e->image + i - literals, SIZE_WORD, literals) < 0)) {
+			return -1;
+		} else {
+			fill = 0;
+		}
+	}
+
+	if ((out != size) || (nwrite(io, ctx, chunk, SIZE_WORD, fill) < 0)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+static int emelf_segment_write(const struct emelf_segment *seg, const struct emelf_io *io, void *ctx)
+{
+	const uint16_t hdr[EMELF_SEGMENT_HDR] = { seg->id, seg->addr >> 16, seg->addr & 65535 };
+
+	if (nwrite(io, ctx, hdr, SIZE_WORD, EMELF_SEGMENT_HDR) < 0) {
+		return -1;
+	}
+
+	return nwrite(io, ctx, seg->data, SIZE_WORD, seg->size);
+}
+
+// -----------------------------------------------------------------------
+static int emelf_hash_prepare(struct emelf *e)
+{
+	int i;
+	int res;
+
+	// version 0 readers don't know the hash section
+	if (!e->eh.version && !e->map) {
+		int count = 0;
+		for (i=0 ; i<e->eh.sec_count ; i++) {
+			if (e->section[i].type != EMELF_SEC_SYM_HASH) {
+				e->section[count++] = e->section[i];
+			}
+		}
+		e->eh.sec_count = count;
+		return EMELF_E_OK;
+	}
+
+	if (!e->symbol_count) {
+		return EMELF_E_OK;
+	}
+
+	if (!e->hsymbol) {
+		res = emelf_symbol_hash_build(e);
+		if (res != EMELF_E_OK) {
+			return res;
+		}
+	}
+
+	// objects from before the hash section get one (if they can be modified)
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+		if (e->section[i].type == EMELF_SEC_SYM_HASH) {
+			return EMELF_E_OK;
+		}
+	}
+	if (!e->map) {
+		return emelf_section_add(e, EMELF_SEC_SYM_HASH);
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+// Lay out the object for writing, returns its size or -error
+static long emelf_write_prepare(struct emelf *e)
+{
+	int res;
+
+	res = emelf_lazy_load(e, e->lazy_pending);
+	if (res != EMELF_E_OK) {
+		return -res;
+	}
+
+	res = emelf_hash_prepare(e);
+	if (res != EMELF_E_OK) {
+		return -res;
+	}
+
+	// version 0 objects keep their names table layout
+	if (e->eh.version) {
+		res = estrtab_pack(e);
+		if (res != EMELF_E_OK) {
+			return -res;
+		}
+	}
+
+	// section offsets are known up front, so the object is written in one go
+	return emelf_layout(e);
+}
+
+// -----------------------------------------------------------------------
+// Write object laid out by emelf_write_prepare()
+static int emelf_write_sections(struct emelf *e, const struct emelf_io *io, void *ctx)
+{
+	int i;
+	int res = 0;
+	int seg = 0;
+	long pos = SIZE_HEADER;
+
+	// write header
+	res = emelf_header_write(e, io, ctx);
 	if (res != EMELF_E_OK) {
 		return res;
 	}
 
 	// write section contents
 	for (i=0 ; i<e->eh.sec_count ; i++) {
-		e->section[i].offset = ftell(f);
+		uint64_t start = estats_start();
+		if (emelf_pad_write(io, ctx, e->section[i].offset - pos) < 0) {
+			return EMELF_E_FWRITE;
+		}
+		pos = e->section[i].offset + e->section[i].size * emelf_section_elem_size(e->section[i].type);
+
 		switch (e->section[i].type) {
 			case EMELF_SEC_IMAGE:
-				res = nfwrite(e->image, SIZE_WORD, e->image_size, f);
+				if (e->eh.flags & EMELF_FLAG_IMAGE_RLE) {
+					res = emelf_image_rle_write(e, io, ctx, e->section[i].size);
+				} else {
+					res = nwrite(io, ctx, e->image, SIZE_WORD, e->image_size);
+				}
 				break;
 			case EMELF_SEC_RELOC:
-				res = nfwrite(e->reloc, SIZE_RELOC, e->reloc_count, f);
+				res = nwrite(io, ctx, e->reloc, SIZE_RELOC, e->reloc_count);
 				break;
 			case EMELF_SEC_SYM:
-				res = nfwrite(e->symbol, SIZE_SYMBOL, e->symbol_count, f);
+				res = nwrite(io, ctx, e->symbol, SIZE_SYMBOL, e->symbol_count);
 				break;
 			case EMELF_SEC_SYM_NAMES:
-				res = fwrite(e->symbol_names, SIZE_CHAR, e->symbol_names_len, f);
+				res = io->write(ctx, e->symbol_names, SIZE_CHAR * e->symbol_names_len) == e->symbol_names_len ? 0 : -1;
 				break;
-			case EMELF_SEC_DEBUG:
-				res = 0;
+			case EMELF_SEC_SYM_HASH:
+				res = emelf_hash_write(e, io, ctx, e->section[i].size);
 				break;
-			case EMELF_SEC_IDENT:
-				res = 0;
+			case EMELF_SEC_SEGMENT:
+				res = emelf_segment_write(e->segment + seg++, io, ctx);
+				break;
+			case EMELF_SEC_REGS:
+				res = nwrite(io, ctx, e->regs, SIZE_WORD, e->reg_count);
 				break;
 			default:
 				res = 0;
-				return EMELF_E_SECTION;
+				break;
 		}
 
 		if (res < 0) {
 			return EMELF_E_FWRITE;
 		}
-
-		e->section[i].size = res;
+		estats_section(e, e->section[i].type, EMELF_STAT_WRITE, (uint64_t) e->section[i].size * emelf_section_elem_size(e->section[i].type), start);
 	}
 
-	int section_hdr = ftell(f);
-	if (section_hdr < 0) {
+	// write sections
+	long section_hdr = ((long) (e->eh.sec_header_hi) << 16) + e->eh.sec_header_lo;
+	if (emelf_pad_write(io, ctx, section_hdr - pos) < 0) {
 		return EMELF_E_FWRITE;
 	}
-	e->eh.sec_header_hi = section_hdr >> 16;
-	e->eh.sec_header_lo = section_hdr & 65535;
-
-	// write sections
-	res = nfwrite(e->section, SIZE_SECTION, e->eh.sec_count, f);
+	res = emelf_section_list_write(e, io, ctx);
 	if (res < 0) {
 		return EMELF_E_FWRITE;
 	}
 
-	// rewrite header (updates section location)
-	res = emelf_header_write(e, f);
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int emelf_write_io(struct emelf *e, const struct emelf_io *io, void *ctx)
+{
+	assert(e);
+
+	long len = emelf_write_prepare(e);
+	if (len < 0) {
+		return -len;
+	}
+
+	return emelf_write_sections(e, io, ctx);
+}
+
+// -----------------------------------------------------------------------
+int emelf_write(struct emelf *e, FILE *f)
+{
+	// section offsets count from the start of the file
+	rewind(f);
+
+	return emelf_write_io(e, &emelf_io_stdio, f);
+}
+
+// -----------------------------------------------------------------------
+int emelf_write_mem(struct emelf *e, void **buf, size_t *size)
+{
+	assert(e);
+	assert(buf && size);
+
+	int res;
+	int allocated = 0;
+
+	long len = emelf_write_prepare(e);
+	if (len < 0) {
+		return -len;
+	}
+
+	// allocate buffer of the exact size, or fill the one provided
+	if (!*buf) {
+		*buf = malloc(len);
+		if (!*buf) {
+			return EMELF_E_ALLOC;
+		}
+		allocated = 1;
+	} else if (*size < (size_t) len) {
+		return EMELF_E_FWRITE;
+	}
+
+	struct emelf_membuf mb = {
+		.buf = *buf,
+		.size = len,
+		.pos = 0,
+	};
+
+	res = emelf_write_sections(e, &emelf_io_mem, &mb);
 	if (res != EMELF_E_OK) {
+		if (allocated) {
+			free(*buf);
+			*buf = NULL;
+		}
 		return res;
 	}
 
+	*size = len;
+
 	return EMELF_E_OK;
 }
 
@@ -0,0 +1,274 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <libgen.h>
+
+#include "emelf.h"
+
+enum modes { MODE_NONE, MODE_CREATE, MODE_LIST, MODE_SYMBOLS, MODE_EXTRACT };
+
+int mode;
+char *archive;
+char **files;
+int file_count;
+
+// -----------------------------------------------------------------------
+void usage()
+{
+	printf("Usage: emelfar -c|-t|-s|-x archive [file ...]\n");
+	printf("Where options are:\n");
+	printf("   -c        : create archive from files\n");
+	printf("   -t        : list archive members\n");
+	printf("   -s        : list archive symbol directory\n");
+	printf("   -x        : extract members (all, or the ones given) to current directory\n");
+	printf("   -v        : print version end exit\n");
+	printf("   -h        : print help and exit\n");
+}
+
+// -----------------------------------------------------------------------
+int parse_args(int argc, char **argv)
+{
+	int option;
+	while ((option = getopt(argc, argv,"ctsxvh")) != -1) {
+		if (mode && strchr("ctsx", option)) {
+			printf("Only one of -c, -t, -s, -x can be used.\n");
+			return -1;
+		}
+		switch (option) {
+			case 'c':
+				mode = MODE_CREATE;
+				break;
+			case 't':
+				mode = MODE_LIST;
+				break;
+			case 's':
+				mode = MODE_SYMBOLS;
+				break;
+			case 'x':
+				mode = MODE_EXTRACT;
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break;
+			case 'v':
+				printf("EMELFAR v%s - EMELF archiver\n", EMELF_VERSION);
+				exit(0);
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	if (!mode || (optind >= argc)) {
+		printf("Wrong usage.\n");
+		usage();
+		return -1;
+	}
+
+	archive = argv[optind];
+	files = argv + optind + 1;
+	file_count = argc - optind - 1;
+
+	if ((mode == MODE_CREATE) && (file_count <= 0)) {
+		printf("No files to archive.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int create()
+{
+	int i;
+	int res;
+	int ret = -1;
+	FILE *f;
+	struct emelf **obj;
+	char **names;
+
+	obj = calloc(file_count, sizeof(struct emelf *));
+	names = calloc(file_count, sizeof(char *));
+	if (!obj || !names) {
+		printf("Memory allocation error.\n");
+		goto cleanup;
+	}
+
+	for (i=0 ; i<file_count ; i++) {
+		obj[i] = emelf_open(files[i]);
+		if (!obj[i]) {
+			printf("Cannot read EMELF contents of '%s'.\n", files[i]);
+			goto cleanup;
+		}
+		char *path = strdup(files[i]);
+		if (!path) {
+			printf("Memory allocation error.\n");
+			goto cleanup;
+		}
+		names[i] = strdup(basename(path));
+		free(path);
+		if (!names[i]) {
+			printf("Memory allocation error.\n");
+			goto cleanup;
+		}
+	}
+
+	f = fopen(archive, "w");
+	if (!f) {
+		printf("Cannot open archive '%s' for writing.\n", archive);
+		goto cleanup;
+	}
+	res = emelf_ar_write(f, obj, names, file_count);
+	fclose(f);
+	if (res == EMELF_E_DUPSYM) {
+		printf("Symbol defined in more than one member.\n");
+		goto cleanup;
+	} else if (res != EMELF_E_OK) {
+		printf("Cannot write archive '%s'.\n", archive);
+		goto cleanup;
+	}
+
+	ret = 0;
+
+cleanup:
+	for (i=0 ; i<file_count ; i++) {
+		if (obj) emelf_destroy(obj[i]);
+		if (names) free(names[i]);
+	}
+	free(obj);
+	free(names);
+	return ret;
+}
+
+// -----------------------------------------------------------------------
+int list(struct emelf_ar *ar)
+{
+	int i;
+	size_t size;
+
+	printf("  Size     Name\n");
+	for (i=0 ; i<emelf_ar_member_count(ar) ; i++) {
+		emelf_ar_member_data(ar, i, &size);
+		printf("  %-8zu %s\n", size, emelf_ar_member_name(ar, i));
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int symbols(struct emelf_ar *ar)
+{
+	unsigned i;
+
+	printf("  %-20s Member\n", "Symbol");
+	for (i=0 ; i<emelf_ar_symbol_count(ar) ; i++) {
+		printf("  %-20s %s\n", emelf_ar_symbol_name(ar, i), emelf_ar_member_name(ar, emelf_ar_symbol_member(ar, i)));
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int extract(struct emelf_ar *ar)
+{
+	int i, j;
+	int ret = 0;
+	size_t size;
+	const void *data;
+	FILE *f;
+
+	for (i=0 ; i<emelf_ar_member_count(ar) ; i++) {
+		const char *name = emelf_ar_member_name(ar, i);
+
+		if (file_count > 0) {
+			for (j=0 ; j<file_count ; j++) {
+				if (!strcmp(files[j], name)) break;
+			}
+			if (j >= file_count) {
+				continue;
+			}
+		}
+
+		// members are written to current directory only
+		if (!*name || strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) {
+			printf("Skipping member with invalid name '%s'.\n", name);
+			ret = -1;
+			continue;
+		}
+
+		data = emelf_ar_member_data(ar, i, &size);
+		f = fopen(name, "w");
+		if (!f) {
+			printf("Cannot open output file '%s'.\n", name);
+			ret = -1;
+			continue;
+		}
+		if (fwrite(data, 1, size, f) != size) {
+			printf("Cannot write output file '%s'.\n", name);
+			ret = -1;
+		}
+		fclose(f);
+	}
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	int res;
+	struct emelf_ar *ar;
+
+	res = parse_args(argc, argv);
+	if (res < 0) {
+		exit(res);
+	}
+
+	if (mode == MODE_CREATE) {
+		return create();
+	}
+
+	ar = emelf_ar_open(archive);
+	if (!ar) {
+		printf("Cannot read EMELF archive '%s'.\n", archive);
+		exit(-1);
+	}
+
+	switch (mode) {
+		case MODE_LIST:
+			res = list(ar);
+			break;
+		case MODE_SYMBOLS:
+			res = symbols(ar);
+			break;
+		default:
+			res = extract(ar);
+			break;
+	}
+
+	emelf_ar_close(ar);
+
+	return res;
+}
+
+// vim: tabstop=4 autoindent
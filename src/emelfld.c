@@ -0,0 +1,341 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "emelf.h"
+#include "edh.h"
+
+char *output_file;
+char **input;
+int input_count;
+
+struct emelf **obj;
+int obj_count;
+
+struct emelf_ar **ar;
+char **ar_loaded;
+int ar_count;
+
+// names already defined or already looked up in archives
+const char **names;
+unsigned names_size;
+unsigned names_count;
+
+// -----------------------------------------------------------------------
+void usage()
+{
+	printf("Usage: emelfld [options] file|archive [file|archive ...]\n");
+	printf("Where options are one or more of:\n");
+	printf("   -o output : output file (required)\n");
+	printf("   -v        : print version end exit\n");
+	printf("   -h        : print help and exit\n");
+	printf("Input objects are placed in memory in the order given.\n");
+	printf("Archive members are added after them, when needed for undefined symbols.\n");
+}
+
+// -----------------------------------------------------------------------
+int parse_args(int argc, char **argv)
+{
+	int option;
+	while ((option = getopt(argc, argv,"o:vh")) != -1) {
+		switch (option) {
+			case 'o':
+				output_file = optarg;
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break;
+			case 'v':
+				printf("EMELFLD v%s - EMELF linker\n", EMELF_VERSION);
+				exit(0);
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	if ((optind >= argc) || !output_file) {
+		printf("Wrong usage.\n");
+		usage();
+		return -1;
+	}
+
+	input = argv + optind;
+	input_count = argc - optind;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int add_input(const char *path)
+{
+	struct emelf_ar *a = emelf_ar_open(path);
+	if (a) {
+		char **loaded = realloc(ar_loaded, (ar_count + 1) * sizeof(char *));
+		if (!loaded) {
+			emelf_ar_close(a);
+			return -1;
+		}
+		ar_loaded = loaded;
+		ar_loaded[ar_count] = calloc(emelf_ar_member_count(a) + 1, 1);
+		if (!ar_loaded[ar_count]) {
+			emelf_ar_close(a);
+			return -1;
+		}
+		ar[ar_count] = a;
+		ar_count++;
+		return 0;
+	}
+
+	obj[obj_count] = emelf_open(path);
+	if (!obj[obj_count]) {
+		return -1;
+	}
+	obj_count++;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+// Returns 1 if the name was added, 0 if it was already there, -1 on error
+int name_add(const char *name)
+{
+	unsigned i;
+	unsigned mask;
+
+	// keep load at or below 1/2
+	if ((names_count + 1) * 2 > names_size) {
+		unsigned old_size = names_size;
+		const char **old = names;
+		const char **grown = calloc(old_size ? old_size * 2 : 256, sizeof(char *));
+		if (!grown) {
+			return -1;
+		}
+		names = grown;
+		names_size = old_size ? old_size * 2 : 256;
+		names_count = 0;
+		for (i=0 ; i<old_size ; i++) {
+			if (old[i]) {
+				name_add(old[i]);
+			}
+		}
+		free(old);
+	}
+
+	mask = names_size - 1;
+	// same hash as object symbol indexes use
+	i = edh_hash(name) & mask;
+	while (names[i]) {
+		if (!strcmp(names[i], name)) {
+			return 0;
+		}
+		i = (i + 1) & mask;
+	}
+	names[i] = name;
+	names_count++;
+
+	return 1;
+}
+
+// -----------------------------------------------------------------------
+int add_defined(struct emelf *e)
+{
+	int i;
+	struct emelf_symbol *sym = emelf_symbols(e);
+	char *sym_names = emelf_symbol_names(e);
+
+	if (!sym || !sym_names) {
+		return -1;
+	}
+
+	for (i=0 ; i<e->symbol_count ; i++) {
+		if ((sym[i].flags & EMELF_SYM_GLOBAL) && (name_add(sym_names + sym[i].offset) < 0)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+// Returns 0 if a member was loaded, 1 if no archive has one to offer, -1 on error
+int add_member(const char *sym_name)
+{
+	int i;
+	int m;
+
+	// first archive that defines the symbol wins
+	for (i=0 ; i<ar_count ; i++) {
+		m = emelf_ar_find(ar[i], sym_name);
+		if ((m < 0) || ar_loaded[i][m]) {
+			continue;
+		}
+		struct emelf **o = realloc(obj, (obj_count + 1) * sizeof(struct emelf *));
+		if (!o) {
+			return -1;
+		}
+		obj = o;
+		obj[obj_count] = emelf_ar_member_load(ar[i], m);
+		if (!obj[obj_count]) {
+			return -1;
+		}
+		obj_count++;
+		ar_loaded[i][m] = 1;
+		return add_defined(obj[obj_count-1]);
+	}
+
+	return 1;
+}
+
+// -----------------------------------------------------------------------
+// Pull in archive members needed by undefined symbols. Objects appended
+// by add_member() are scanned in turn, so obj[] is the worklist and each
+// name is looked up in archives at most once.
+int add_members()
+{
+	int o;
+	int i;
+
+	for (o=0 ; o<obj_count ; o++) {
+		if (add_defined(obj[o])) {
+			return -1;
+		}
+	}
+
+	for (o=0 ; o<obj_count ; o++) {
+		struct emelf *e = obj[o];
+		for (i=0 ; i<e->symbol_count ; i++) {
+			if (e->symbol[i].flags & EMELF_SYM_GLOBAL) {
+				continue;
+			}
+			const char *name = e->symbol_names + e->symbol[i].offset;
+			int res = name_add(name);
+			if (res < 0) {
+				return -1;
+			} else if (res && (add_member(name) < 0)) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	int i;
+	int res;
+	int ret = -1;
+	char *sym_name = NULL;
+	struct emelf *out = NULL;
+	FILE *f;
+
+	res = parse_args(argc, argv);
+	if (res < 0) {
+		exit(res);
+	}
+
+	obj = calloc(input_count, sizeof(struct emelf *));
+	ar = calloc(input_count, sizeof(struct emelf_ar *));
+	if (!obj || !ar) {
+		printf("Memory allocation error.\n");
+		goto cleanup;
+	}
+
+	for (i=0 ; i<input_count ; i++) {
+		if (add_input(input[i])) {
+			printf("Cannot read EMELF contents of '%s'.\n", input[i]);
+			goto cleanup;
+		}
+	}
+
+	if (ar_count && add_members()) {
+		printf("Cannot load archive members.\n");
+		goto cleanup;
+	}
+
+	// whatever archives could not resolve is reported here
+	out = emelf_link(obj, obj_count, &sym_name);
+	if (!out) {
+		switch (emelf_error()) {
+			case EMELF_E_UNDEF:
+				printf("Undefined symbol: %s\n", sym_name);
+				break;
+			case EMELF_E_DUPSYM:
+				printf("Symbol defined more than once: %s\n", sym_name);
+				break;
+			case EMELF_E_COUNT:
+				printf("No objects to link.\n");
+				break;
+			case EMELF_E_ADDR:
+				printf("Linked image does not fit in memory.\n");
+				break;
+			case EMELF_E_TYPE:
+				printf("Only relocatable objects can be linked.\n");
+				break;
+			case EMELF_E_CPU:
+			case EMELF_E_ABI:
+				printf("Objects are for different CPUs or ABIs.\n");
+				break;
+			default:
+				printf("Cannot link objects (error %i).\n", emelf_error());
+				break;
+		}
+		goto cleanup;
+	}
+
+	f = fopen(output_file, "w");
+	if (!f) {
+		printf("Cannot open output file '%s'.\n", output_file);
+		goto cleanup;
+	}
+	res = emelf_write(out, f);
+	// buffered data is written out by fclose(), which can fail too
+	if ((fclose(f) != 0) && (res == EMELF_E_OK)) {
+		res = EMELF_E_FWRITE;
+	}
+	if (res != EMELF_E_OK) {
+		printf("Cannot write output file '%s'.\n", output_file);
+		goto cleanup;
+	}
+
+	ret = 0;
+
+cleanup:
+	emelf_destroy(out);
+	for (i=0 ; i<obj_count ; i++) {
+		emelf_destroy(obj[i]);
+	}
+	for (i=0 ; i<ar_count ; i++) {
+		emelf_ar_close(ar[i]);
+		free(ar_loaded[i]);
+	}
+	free(obj);
+	free(ar);
+	free(ar_loaded);
+	free(names);
+	return ret;
+}
+
+// vim: tabstop=4 autoindent
@@ -17,14 +17,36 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 
 #include "emelf.h"
 
-char *input_file;
+struct job {
+	char *path;
+	char *out;
+	size_t out_len;
+	int done;
+	int ok;
+	unsigned image_words;
+	unsigned relocs;
+	unsigned symbols;
+};
+
+struct job *input;
+int input_count, input_slots;
+int next_job;
+pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
 char *output_image;
-int show_header, show_sections, show_relocs, show_symbols;
+int show_header, show_sections, show_relocs, show_symbols, show_core, show_stats, show_totals, show_index;
+int jobs;
 
 char *emelf_types_n[] = {
 	"UNKNOWN",
@@ -52,7 +74,10 @@ char *emelf_section_types_n[] = {
 	"SYM",
 	"SYM_NAMES",
 	"DEBUG",
-	"IDENT"
+	"IDENT",
+	"SYM_HASH",
+	"SEGMENT",
+	"REGS"
 };
 
 int emelf_elem_sizes[] = {
@@ -62,41 +87,44 @@ int emelf_elem_sizes[] = {
 	SIZE_SYMBOL,
 	SIZE_CHAR,
 	0,
-	SIZE_CHAR
+	SIZE_CHAR,
+	SIZE_HASH_SLOT,
+	SIZE_WORD,
+	SIZE_WORD
 };
 
 // -----------------------------------------------------------------------
-void emelf_print_header(struct emelf *e)
+void emelf_print_header(FILE *out, struct emelf *e)
 {
-	printf("EMELF header\n");
-	printf("  Magic : \\%o %s\n", *(e->eh.magic)&255, e->eh.magic+1);
-	printf("  Ver.  : %i\n", e->eh.version);
-	printf("  Type  : %i (%s)\n", e->eh.type, emelf_types_n[e->eh.type]);
-	printf("  Flags : %i\n", e->eh.flags);
-	printf("  CPU   : %i (%s)\n", e->eh.cpu, emelf_cpu_n[e->eh.cpu]);
-	printf("  ABI   : %i (%s)\n", e->eh.abi, emelf_abi_types_n[e->eh.abi]);
+	fprintf(out, "EMELF header\n");
+	fprintf(out, "  Magic : \\%o %s\n", *(e->eh.magic)&255, e->eh.magic+1);
+	fprintf(out, "  Ver.  : %i\n", e->eh.version);
+	fprintf(out, "  Type  : %i (%s)\n", e->eh.type, emelf_types_n[e->eh.type]);
+	fprintf(out, "  Flags : %i\n", e->eh.flags);
+	fprintf(out, "  CPU   : %i (%s)\n", e->eh.cpu, emelf_cpu_n[e->eh.cpu]);
+	fprintf(out, "  ABI   : %i (%s)\n", e->eh.abi, emelf_abi_types_n[e->eh.abi]);
 	if (e->eh.flags & EMELF_FLAG_ENTRY) {
-		printf("  Entry : 0x%04x\n", e->eh.entry);
+		fprintf(out, "  Entry : 0x%04x\n", e->eh.entry);
 	} else {
-		printf("  Entry : not set\n");
+		fprintf(out, "  Entry : not set\n");
 	}
 }
 
 // -----------------------------------------------------------------------
-void emelf_print_sections(struct emelf *e)
+void emelf_print_sections(FILE *out, struct emelf *e)
 {
 	int i;
 
 	if (e->eh.sec_count <= 0) {
-		printf("No sections\n");
+		fprintf(out, "No sections\n");
 		return;
 	}
 
-	printf("Sections\n");
-	printf("      Type       Offset  Chunk  Elems  Bytes\n");
+	fprintf(out, "Sections\n");
+	fprintf(out, "      Type       Offset  Chunk  Elems  Bytes\n");
 	for (i=0 ; i<e->eh.sec_count ; i++) {
 		struct emelf_section *sec = e->section + i;
-		printf("  %-3i %-10s %-7i %-6i %-6i %-6i\n",
+		fprintf(out, "  %-3i %-10s %-7u %-6i %-6u %-6u\n",
 			i,
 			emelf_section_types_n[sec->type],
 			sec->offset,
@@ -108,80 +136,236 @@ void emelf_print_sections(struct emelf *e)
 }
 
 // -----------------------------------------------------------------------
-void emelf_print_relocs(struct emelf *e)
+void emelf_print_relocs(FILE *out, struct emelf *e)
 {
 	int i;
 
 	if (e->reloc_count <= 0) {
-		printf("No relocations\n");
+		fprintf(out, "No relocations\n");
 		return;
 	}
 
-	printf("Relocations\n");
-	printf("  Addr    Value   Reloc\n");
+	fprintf(out, "Relocations\n");
+	fprintf(out, "  Addr    Value   Reloc\n");
 	for (i=0 ; i<e->reloc_count ; i++) {
 		struct emelf_reloc *rel = e->reloc + i;
-		printf("  0x%04x  %-7i ", rel->addr, (int16_t) e->image[rel->addr]);
+		if (rel->addr < e->image_size) {
+			fprintf(out, "  0x%04x  %-7i ", rel->addr, (int16_t) e->image[rel->addr]);
+		} else {
+			fprintf(out, "  0x%04x  %-7s ", rel->addr, "?");
+		}
 		if (rel->flags & EMELF_RELOC_BASE) {
-			printf("@start ");
-			if (rel->flags & EMELF_RELOC_SYM) printf("%s %s",
+			fprintf(out, "@start ");
+			if (rel->flags & EMELF_RELOC_SYM) fprintf(out, "%s %s",
 				(rel->flags & EMELF_RELOC_SYM_NEG) ? "-" : "+",
 				e->symbol_names + e->symbol[rel->sym_idx].offset
 			);
 		} else {
-			if (rel->flags & EMELF_RELOC_SYM) printf("%s%s",
+			if (rel->flags & EMELF_RELOC_SYM) fprintf(out, "%s%s",
 				(rel->flags & EMELF_RELOC_SYM_NEG) ? "-" : "",
 				e->symbol_names + e->symbol[rel->sym_idx].offset
 			);
 		}
-		printf("\n");
+		fprintf(out, "\n");
 	}
 }
 
 // -----------------------------------------------------------------------
-void emelf_print_symbols(struct emelf *e)
+void emelf_print_symbols(FILE *out, struct emelf *e)
 {
 	int i;
 
 	if (e->symbol_count <= 0) {
-		printf("No symbols\n");
+		fprintf(out, "No symbols\n");
 		return;
 	}
 
-	printf("Symbols\n");
+	fprintf(out, "Symbols\n");
 	for (i=0 ; i<e->symbol_count; i++) {
 		struct emelf_symbol *sym = e->symbol + i;
-		printf("  %-10s = ", e->symbol_names + sym->offset);
+		fprintf(out, "  %-10s = ", e->symbol_names + sym->offset);
 		if (sym->flags & EMELF_SYM_GLOBAL) {
-			printf("%i", sym->value);
-			if (sym->flags & EMELF_SYM_RELATIVE) printf(" + @start");
+			fprintf(out, "%i", sym->value);
+			if (sym->flags & EMELF_SYM_RELATIVE) fprintf(out, " + @start");
 		} else {
-			printf("?");
+			fprintf(out, "?");
+		}
+		fprintf(out, "\n");
+	}
+}
+
+// -----------------------------------------------------------------------
+void emelf_print_core(FILE *out, struct emelf *e)
+{
+	int i;
+
+	if (e->reg_count > 0) {
+		fprintf(out, "Registers\n");
+		for (i=0 ; i<e->reg_count ; i++) {
+			fprintf(out, "%s0x%04x", (i % 8) ? " " : "  ", e->regs[i]);
+			if ((i % 8 == 7) || (i == e->reg_count - 1)) {
+				fprintf(out, "\n");
+			}
+		}
+	} else {
+		fprintf(out, "No registers\n");
+	}
+
+	if (e->segment_count <= 0) {
+		fprintf(out, "No memory segments\n");
+		return;
+	}
+
+	fprintf(out, "Memory segments%s\n", (e->eh.flags & EMELF_FLAG_CORE_DELTA) ? " (delta)" : "");
+	fprintf(out, "  Id     Addr        Words\n");
+	for (i=0 ; i<e->segment_count ; i++) {
+		struct emelf_segment *seg = e->segment + i;
+		fprintf(out, "  %-6u 0x%08x  %u\n", seg->id, seg->addr, seg->size);
+	}
+}
+
+// -----------------------------------------------------------------------
+void emelf_print_io_stats(FILE *out, const struct emelf_stats *s)
+{
+	int type, op;
+	static const char *op_n[] = { "read", "write", "swap" };
+
+	fprintf(out, "  Allocations : %llu (%llu bytes), frees: %llu\n", s->allocs, s->alloc_bytes, s->frees);
+	fprintf(out, "  Section    Op     Count    Bytes        Time [us]  MB/s\n");
+	for (type=EMELF_SEC_UNKNOWN+1 ; type<EMELF_SEC_MAX ; type++) {
+		for (op=0 ; op<EMELF_STAT_OP_MAX ; op++) {
+			const struct emelf_op_stats *o = &s->sec[type][op];
+			if (!o->count) continue;
+			fprintf(out, "  %-10s %-6s %-8llu %-12llu %-10.1f ",
+				emelf_section_types_n[type],
+				op_n[op],
+				o->count,
+				o->bytes,
+				o->ns / 1e3
+			);
+			if (o->ns) {
+				fprintf(out, "%.1f\n", o->bytes * 1e3 / o->ns);
+			} else {
+				fprintf(out, "-\n");
+			}
 		}
-		printf("\n");
+	}
+}
+
+// -----------------------------------------------------------------------
+void emelf_print_stats(FILE *out, struct emelf *e)
+{
+	struct emelf_hash_stats hs;
+	const struct emelf_stats *s = emelf_stats_get(e);
+
+	fprintf(out, "Statistics\n");
+	if (s) {
+		emelf_print_io_stats(out, s);
+	}
+
+	if (emelf_hash_stats(e, &hs) != EMELF_E_OK) {
+		fprintf(out, "  Symbol hash : cannot build\n");
+	} else if (!hs.slots) {
+		fprintf(out, "  Symbol hash : none\n");
+	} else {
+		fprintf(out, "  Symbol hash : %u symbols in %u slots (%.1f%% full), %u displaced, probes: %.2f avg, %u max\n",
+			hs.count,
+			hs.slots,
+			100.0 * hs.count / hs.slots,
+			hs.displaced,
+			hs.avg_probes,
+			hs.max_probes
+		);
 	}
 }
 
 // -----------------------------------------------------------------------
 void usage()
 {
-	printf("Usage: emelfread options file\n");
+	printf("Usage: emelfread options file|dir [file|dir ...]\n");
 	printf("Where options are one or more of:\n");
 	printf("   -e        : show EMELF header\n");
 	printf("   -s        : show sections\n");
 	printf("   -r        : show relocations\n");
 	printf("   -n        : show symbol names\n");
-	printf("   -a        : show all (same as -esrn)\n");
-	printf("   -o output : dump image to output file\n");
+	printf("   -c        : show core registers and memory segments\n");
+	printf("   -S        : show statistics (allocations, symbol hash, section I/O times)\n");
+	printf("   -a        : show all (same as -esrnc)\n");
+	printf("   -t        : show totals for all input files\n");
+	printf("   -i        : show one-line summary of each file (reads headers only)\n");
+	printf("   -j jobs   : number of worker threads for multiple inputs (default: CPU count)\n");
+	printf("   -o output : dump image to output file (single input only)\n");
 	printf("   -v        : print version end exit\n");
 	printf("   -h        : print help and exit\n");
+	printf("Directories are searched recursively for input files.\n");
+}
+
+// -----------------------------------------------------------------------
+int input_add(const char *path)
+{
+	if (input_count >= input_slots) {
+		input_slots = input_slots ? input_slots * 2 : 64;
+		struct job *jobs = realloc(input, input_slots * sizeof(struct job));
+		if (!jobs) {
+			return -1;
+		}
+		input = jobs;
+	}
+
+	memset(input + input_count, 0, sizeof(struct job));
+	input[input_count].path = strdup(path);
+	if (!input[input_count].path) {
+		return -1;
+	}
+	input_count++;
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int input_walk(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	if (typeflag == FTW_F) {
+		return input_add(fpath);
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int input_cmp(const void *a, const void *b)
+{
+	return strcmp(((struct job*) a)->path, ((struct job*) b)->path);
+}
+
+// -----------------------------------------------------------------------
+int input_collect(int argc, char **argv)
+{
+	int i;
+	struct stat st;
+
+	for (i=0 ; i<argc ; i++) {
+		if (!stat(argv[i], &st) && S_ISDIR(st.st_mode)) {
+			int first = input_count;
+			if (nftw(argv[i], input_walk, 32, FTW_PHYS)) {
+				printf("Cannot read directory '%s'.\n", argv[i]);
+				return -1;
+			}
+			qsort(input + first, input_count - first, sizeof(struct job), input_cmp);
+		} else if (input_add(argv[i])) {
+			printf("Memory allocation error.\n");
+			return -1;
+		}
+	}
+
+	return 0;
 }
 
 // -----------------------------------------------------------------------
 int parse_args(int argc, char **argv)
 {
 	int option;
-	while ((option = getopt(argc, argv,"esrnao:vh")) != -1) {
+	while ((option = getopt(argc, argv,"esrncSatij:o:vh")) != -1) {
 		switch (option) {
 			case 'e':
 				show_header = 1;
@@ -195,11 +379,31 @@ int parse_args(int argc, char **argv)
 			case 'n':
 				show_symbols = 1;
 				break;
+			case 'c':
+				show_core = 1;
+				break;
+			case 'S':
+				show_stats = 1;
+				break;
 			case 'a':
 				show_header = 1;
 				show_sections = 1;
 				show_relocs = 1;
 				show_symbols = 1;
+				show_core = 1;
+				break;
+			case 't':
+				show_totals = 1;
+				break;
+			case 'i':
+				show_index = 1;
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs <= 0) {
+					printf("Wrong number of jobs: %s\n", optarg);
+					return -1;
+				}
 				break;
 			case 'o':
 				output_image = optarg;
@@ -217,82 +421,279 @@ int parse_args(int argc, char **argv)
 		}
 	}
 
-	if (optind == argc-1) {
-		input_file = argv[optind];
-	} else {
+	if (optind >= argc) {
 		printf("Wrong usage.\n");
 		usage();
 		return -1;
 	}
 
+	if (input_collect(argc - optind, argv + optind)) {
+		return -1;
+	}
+
+	if (show_index && (show_header || show_sections || show_relocs || show_symbols || show_core || show_stats || output_image)) {
+		printf("Option -i cannot be combined with -esrncSao.\n");
+		return -1;
+	}
+
+	if (output_image && (input_count != 1)) {
+		printf("Image can be dumped for a single input file only.\n");
+		return -1;
+	}
+
 	return 0;
 }
 
 // -----------------------------------------------------------------------
-int main(int argc, char **argv)
+void probe(FILE *out, struct job *j)
 {
 	int res;
-	FILE *f;
-	struct emelf *e;
+	struct emelf_info info;
 
-	res = parse_args(argc, argv);
-	if (res < 0) {
-		exit(res);
+	FILE *f = fopen(j->path, "r");
+	if (!f) {
+		fprintf(out, "Cannot open input file '%s'.\n", j->path);
+		return;
 	}
 
-	if (show_header+show_sections+show_relocs+show_symbols+output_image == 0) {
-		printf("Nothing to do, specify at least one of options: -esrnao\n");
-		usage();
-		exit(-1);
+	// only a few dozen bytes get read, buffering would read much more
+	setvbuf(f, NULL, _IONBF, 0);
+	res = emelf_probe(f, &info);
+	fclose(f);
+
+	if (res != EMELF_E_OK) {
+		fprintf(out, "Cannot read EMELF header of '%s'.\n", j->path);
+		return;
 	}
 
-	f = fopen(input_file, "r");
-	if (!f) {
-		printf("Cannot open input file '%s'.\n", input_file);
-		exit(-1);
+	j->ok = 1;
+	j->image_words = info.sec_size[EMELF_SEC_IMAGE];
+	j->relocs = info.sec_size[EMELF_SEC_RELOC];
+	j->symbols = info.sec_size[EMELF_SEC_SYM];
+
+	if (show_index) {
+		fprintf(out, "%-6s %-9s %-5s ",
+			emelf_types_n[info.eh.type],
+			emelf_cpu_n[info.eh.cpu],
+			emelf_abi_types_n[info.eh.abi]
+		);
+		if (info.eh.flags & EMELF_FLAG_ENTRY) {
+			fprintf(out, "0x%04x ", info.eh.entry);
+		} else {
+			fprintf(out, "%-6s ", "-");
+		}
+		fprintf(out, "%-6u %-6u %-7u %s\n", j->image_words, j->relocs, j->symbols, j->path);
 	}
+}
 
-	e = emelf_load(f);
-	fclose(f);
+// -----------------------------------------------------------------------
+void process(struct job *j)
+{
+	FILE *out;
+	struct emelf *e;
+
+	out = open_memstream(&j->out, &j->out_len);
+	if (!out) {
+		return;
+	}
+
+	// when nothing but sizes is needed, skip loading
+	if (!show_header && !show_sections && !show_relocs && !show_symbols && !show_core && !show_stats && !output_image) {
+		probe(out, j);
+		fclose(out);
+		return;
+	}
 
+	e = emelf_open(j->path);
 	if (!e) {
-		printf("Cannot read EMELF contents.\n");
-		exit(-1);
+		fprintf(out, "Cannot read EMELF contents of '%s'.\n", j->path);
+		fclose(out);
+		return;
+	}
+
+	// multiple inputs get a file header and a separator
+	int verbose = (input_count > 1) && (show_header || show_sections || show_relocs || show_symbols || show_core || show_stats);
+
+	if (verbose) {
+		fprintf(out, "File: %s\n", j->path);
 	}
 
+	j->ok = 1;
+	j->image_words = e->image_size;
+	j->relocs = e->reloc_count;
+	j->symbols = e->symbol_count;
+
 	if (show_header) {
-		emelf_print_header(e);
+		emelf_print_header(out, e);
 	}
 
 	if (show_sections) {
-		printf("\n");
-		emelf_print_sections(e);
+		fprintf(out, "\n");
+		emelf_print_sections(out, e);
 	}
 
 	if (show_relocs) {
-		printf("\n");
-		emelf_print_relocs(e);
+		fprintf(out, "\n");
+		emelf_print_relocs(out, e);
 	}
 
 	if (show_symbols) {
-		printf("\n");
-		emelf_print_symbols(e);
+		fprintf(out, "\n");
+		emelf_print_symbols(out, e);
+	}
+
+	if (show_core && (e->eh.type == EMELF_CORE)) {
+		fprintf(out, "\n");
+		emelf_print_core(out, e);
+	}
+
+	if (show_stats) {
+		fprintf(out, "\n");
+		emelf_print_stats(out, e);
 	}
 
 	if (output_image) {
-		f = fopen(output_image, "w");
-		int pos = e->image_size;
+		FILE *f = fopen(output_image, "w");
+		int pos = e->image_size - 1;
 		while (pos >= 0) {
 			e->image[pos] = htons(e->image[pos]);
 			pos--;
 		}
-		fwrite(e->image, sizeof(uint16_t), e->image_size, f);
-		fclose(f);
+		if (!f || (fwrite(e->image, sizeof(uint16_t), e->image_size, f) != e->image_size)) {
+			fprintf(out, "Cannot write image to '%s'.\n", output_image);
+			j->ok = 0;
+		}
+		if (f) fclose(f);
+	}
+
+	if (verbose) {
+		fprintf(out, "\n");
 	}
 
 	emelf_destroy(e);
+	fclose(out);
+}
 
-	return 0;
+// -----------------------------------------------------------------------
+void * worker(void *arg)
+{
+	while (1) {
+		int i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED);
+		if (i >= input_count) {
+			break;
+		}
+
+		process(input + i);
+
+		pthread_mutex_lock(&done_mutex);
+		input[i].done = 1;
+		pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&done_mutex);
+	}
+
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	int i;
+	int res;
+	int failed = 0;
+	unsigned long long image_words = 0, relocs = 0, symbols = 0;
+	pthread_t *threads;
+
+	res = parse_args(argc, argv);
+	if (res < 0) {
+		exit(res);
+	}
+
+	if (!show_header && !show_sections && !show_relocs && !show_symbols && !show_core && !show_stats && !show_totals && !show_index && !output_image) {
+		printf("Nothing to do, specify at least one of options: -esrncStiao\n");
+		usage();
+		exit(-1);
+	}
+
+	if (show_stats) {
+		emelf_stats_enable(1);
+	}
+
+	if (jobs <= 0) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (jobs > input_count) {
+		jobs = input_count;
+	}
+	if (jobs < 1) {
+		jobs = 1;
+	}
+
+	threads = calloc(jobs, sizeof(pthread_t));
+	if (!threads) {
+		printf("Memory allocation error.\n");
+		exit(-1);
+	}
+	for (i=0 ; i<jobs ; i++) {
+		if (pthread_create(threads + i, NULL, worker, NULL)) {
+			printf("Cannot start worker thread.\n");
+			exit(-1);
+		}
+	}
+
+	if (show_index) {
+		printf("%-6s %-9s %-5s %-6s %-6s %-6s %-7s %s\n", "Type", "CPU", "ABI", "Entry", "Image", "Relocs", "Symbols", "File");
+	}
+
+	// print results in input order, as soon as they're ready
+	for (i=0 ; i<input_count ; i++) {
+		struct job *j = input + i;
+
+		pthread_mutex_lock(&done_mutex);
+		while (!j->done) {
+			pthread_cond_wait(&done_cond, &done_mutex);
+		}
+		pthread_mutex_unlock(&done_mutex);
+
+		if (j->out) {
+			fwrite(j->out, 1, j->out_len, stdout);
+			free(j->out);
+		} else {
+			printf("Memory allocation error while processing '%s'.\n", j->path);
+		}
+
+		if (j->ok) {
+			image_words += j->image_words;
+			relocs += j->relocs;
+			symbols += j->symbols;
+		} else {
+			failed++;
+		}
+		free(j->path);
+	}
+
+	for (i=0 ; i<jobs ; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	free(input);
+
+	if (show_totals) {
+		printf("Totals\n");
+		printf("  Files       : %i\n", input_count);
+		printf("  Failed      : %i\n", failed);
+		printf("  Image words : %llu\n", image_words);
+		printf("  Relocations : %llu\n", relocs);
+		printf("  Symbols     : %llu\n", symbols);
+	}
+
+	if (show_stats && (show_totals || (input_count > 1))) {
+		struct emelf_stats s;
+		emelf_stats_global(&s);
+		printf("Process-wide statistics\n");
+		emelf_print_io_stats(stdout, &s);
+	}
+
+	return failed ? -1 : 0;
 }
 
 // vim: tabstop=4 autoindent
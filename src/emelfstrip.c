@@ -0,0 +1,205 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "emelf.h"
+
+char *output_file;
+char **input;
+int input_count;
+int print_summary;
+mode_t file_mode;
+
+// -----------------------------------------------------------------------
+void usage()
+{
+	printf("Usage: emelfstrip [options] file [file ...]\n");
+	printf("Where options are one or more of:\n");
+	printf("   -o output : output file (only for a single input, default: strip in place)\n");
+	printf("   -s        : print relocation, symbol and file size changes\n");
+	printf("   -v        : print version end exit\n");
+	printf("   -h        : print help and exit\n");
+	printf("Relocations against symbols defined in the object are resolved into the image,\n");
+	printf("symbols not needed by relocations (or, in relocatable objects, by other objects)\n");
+	printf("are removed.\n");
+}
+
+// -----------------------------------------------------------------------
+int parse_args(int argc, char **argv)
+{
+	int option;
+	while ((option = getopt(argc, argv,"o:svh")) != -1) {
+		switch (option) {
+			case 'o':
+				output_file = optarg;
+				break;
+			case 's':
+				print_summary = 1;
+				break;
+			case 'h':
+				usage();
+				exit(0);
+				break;
+			case 'v':
+				printf("EMELFSTRIP v%s - EMELF object stripper\n", EMELF_VERSION);
+				exit(0);
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		printf("Wrong usage.\n");
+		usage();
+		return -1;
+	}
+
+	input = argv + optind;
+	input_count = argc - optind;
+
+	if (output_file && (input_count > 1)) {
+		printf("Output file can be given for a single input only.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+int strip(const char *in, const char *out)
+{
+	int res;
+	int ret = -1;
+	int fd = -1;
+	char *tmp = NULL;
+	struct stat st;
+	FILE *f;
+	struct emelf *e;
+
+	// whole object is read, so it can be written back to the same file
+	f = fopen(in, "r");
+	if (!f) {
+		printf("Cannot open input file '%s'.\n", in);
+		return -1;
+	}
+	e = emelf_load(f);
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	if (!e) {
+		printf("Cannot read EMELF contents of '%s'.\n", in);
+		return -1;
+	}
+
+	int reloc_count = e->reloc_count;
+	int symbol_count = e->symbol_count;
+
+	res = emelf_strip(e);
+	if (res != EMELF_E_OK) {
+		printf("Cannot strip '%s' (error %i).\n", in, res);
+		goto cleanup;
+	}
+
+	// written next to the output and renamed over it only when complete,
+	// so a failed write doesn't destroy the file being stripped in place
+	tmp = malloc(strlen(out) + 8);
+	if (!tmp) {
+		printf("Memory allocation error.\n");
+		goto cleanup;
+	}
+	sprintf(tmp, "%s.XXXXXX", out);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		printf("Cannot create temporary file for '%s'.\n", out);
+		goto cleanup;
+	}
+	// keep mode of the file being replaced, new files get the usual one
+	if (!stat(out, &st)) {
+		fchmod(fd, st.st_mode & 07777);
+	} else {
+		fchmod(fd, file_mode);
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		printf("Cannot open output file '%s'.\n", out);
+		goto cleanup;
+	}
+	res = emelf_write(e, f);
+	long stripped_size = ftell(f);
+	if ((fclose(f) != 0) && (res == EMELF_E_OK)) {
+		res = EMELF_E_FWRITE;
+	}
+	if ((res != EMELF_E_OK) || rename(tmp, out)) {
+		printf("Cannot write output file '%s'.\n", out);
+		goto cleanup;
+	}
+	free(tmp);
+	tmp = NULL;
+
+	if (print_summary) {
+		printf("%s: relocations %i -> %i, symbols %i -> %i, size %li -> %li\n",
+			out,
+			reloc_count, e->reloc_count,
+			symbol_count, e->symbol_count,
+			size, stripped_size
+		);
+	}
+
+	ret = 0;
+
+cleanup:
+	if (tmp && (fd >= 0)) {
+		unlink(tmp);
+	}
+	free(tmp);
+	emelf_destroy(e);
+	return ret;
+}
+
+// -----------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	int i;
+	int ret = 0;
+
+	if (parse_args(argc, argv)) {
+		exit(1);
+	}
+
+	// umask can only be read by setting it
+	file_mode = umask(0);
+	umask(file_mode);
+	file_mode = 0666 & ~file_mode;
+
+	for (i=0 ; i<input_count ; i++) {
+		if (strip(input[i], output_file ? output_file : input[i])) {
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
+
+// vim: tabstop=4 autoindent
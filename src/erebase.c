@@ -0,0 +1,324 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+// Rebase plan: relocations of a self-contained object compiled into
+// an image template with all base-independent parts already applied
+// and, for each word that depends on the base, a multiplier k, so that
+// the word at new base is: template + k * base.
+//
+// Sparse plans keep word addresses grouped by multiplier, dense plans
+// (many relocated words) keep a multiplier for each word instead and
+// rebase the whole image in one pass, using SSE2 or AVX2 on x86.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emelf.h"
+#include "eerr.h"
+#include "erel.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EREBASE_X86
+#include <immintrin.h>
+#endif
+
+// above 1/EREBASE_DENSE relocated words a plan is dense
+#define EREBASE_DENSE 32
+
+struct emelf_rebase {
+	unsigned amax;
+	unsigned size;
+	uint16_t *image;
+	uint16_t *mult;			// dense: multiplier for each word
+	unsigned group_count;	// sparse: groups of words with the same multiplier
+	uint16_t *group_mult;
+	unsigned *group_start;
+	uint16_t *addr;
+};
+
+// -----------------------------------------------------------------------
+static int erebase_key_cmp(const void *a, const void *b)
+{
+	uint32_t ka = *(const uint32_t*) a;
+	uint32_t kb = *(const uint32_t*) b;
+
+	return (ka > kb) - (ka < kb);
+}
+
+// -----------------------------------------------------------------------
+static int erebase_group(struct emelf_rebase *rb, unsigned words)
+{
+	unsigned i, n = 0;
+
+	// sort (multiplier, address) keys, so groups come out address-ordered
+	uint32_t *key = malloc((words + 1) * sizeof(uint32_t));
+	rb->addr = malloc((words + 1) * sizeof(uint16_t));
+	rb->group_mult = malloc((words + 1) * sizeof(uint16_t));
+	rb->group_start = malloc((words + 1) * sizeof(unsigned));
+	if (!key || !rb->addr || !rb->group_mult || !rb->group_start) {
+		free(key);
+		return EMELF_E_ALLOC;
+	}
+
+	for (i=0 ; i<rb->size ; i++) {
+		if (rb->mult[i]) {
+			key[n++] = ((uint32_t) rb->mult[i] << 16) | i;
+		}
+	}
+	qsort(key, n, sizeof(uint32_t), erebase_key_cmp);
+
+	for (i=0 ; i<n ; i++) {
+		uint16_t m = key[i] >> 16;
+		if (!i || (m != rb->group_mult[rb->group_count-1])) {
+			rb->group_mult[rb->group_count] = m;
+			rb->group_start[rb->group_count] = i;
+			rb->group_count++;
+		}
+		rb->addr[i] = key[i] & 0xffff;
+	}
+	rb->group_start[rb->group_count] = n;
+
+	// per-word multipliers aren't needed anymore
+	free(key);
+	free(rb->mult);
+	rb->mult = NULL;
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+struct emelf_rebase * emelf_rebase_compile(struct emelf *e)
+{
+	assert(e);
+
+	int i;
+	int res;
+	unsigned words = 0;
+	struct emelf_rebase *rb = NULL;
+
+	if (e->eh.type != EMELF_RELOC) {
+		res = EMELF_E_TYPE;
+		goto cleanup;
+	}
+
+	res = emelf_sections_load(e);
+	if (res != EMELF_E_OK) {
+		goto cleanup;
+	}
+
+	struct erel r = {
+		NULL, e->image_size, 0,
+		e->reloc, e->reloc_count,
+		NULL, NULL, e->symbol_count
+	};
+	res = erel_check(&r);
+	if (res != EMELF_E_OK) {
+		goto cleanup;
+	}
+
+	for (i=0 ; i<e->symbol_count ; i++) {
+		if (!(e->symbol[i].flags & EMELF_SYM_GLOBAL)) {
+			res = EMELF_E_UNDEF;
+			goto cleanup;
+		}
+	}
+
+	rb = calloc(1, sizeof(struct emelf_rebase));
+	if (!rb) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+	rb->amax = e->amax;
+	rb->size = e->image_size;
+	rb->image = malloc((rb->size + 1) * sizeof(uint16_t));
+	rb->mult = calloc(rb->size + 1, sizeof(uint16_t));
+	if (!rb->image || !rb->mult) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+	memcpy(rb->image, e->image, rb->size * sizeof(uint16_t));
+
+	// fold everything but the base into the template,
+	// sum base multipliers for each word
+	for (i=0 ; i<e->reloc_count ; i++) {
+		struct emelf_reloc *rel = e->reloc + i;
+		unsigned scale = (rel->flags & EMELF_RELOC_BYTE) ? 2 : 1;
+		uint16_t *w = rb->image + rel->addr;
+		uint16_t *m = rb->mult + rel->addr;
+
+		if (rel->flags & EMELF_RELOC_BASE) {
+			*m += scale;
+		}
+		if (rel->flags & EMELF_RELOC_SYM) {
+			struct emelf_symbol *s = e->symbol + rel->sym_idx;
+			unsigned v = s->value;
+			unsigned k = 0;
+			if (s->flags & EMELF_SYM_RELATIVE) {
+				v *= scale;
+				k = scale;
+			}
+			if (rel->flags & EMELF_RELOC_SYM_NEG) {
+				*w -= v;
+				*m -= k;
+			} else {
+				*w += v;
+				*m += k;
+			}
+		}
+	}
+
+	for (i=0 ; i<rb->size ; i++) {
+		words += rb->mult[i] ? 1 : 0;
+	}
+
+	if (words * EREBASE_DENSE <= rb->size) {
+		res = erebase_group(rb, words);
+		if (res != EMELF_E_OK) {
+			goto cleanup;
+		}
+	}
+
+	return rb;
+
+cleanup:
+	emelf_seterr(res);
+	emelf_rebase_destroy(rb);
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+static void erebase_dense_scalar(const uint16_t *tmpl, const uint16_t *mult, uint16_t base, uint16_t *image, unsigned len)
+{
+	unsigned i;
+
+	for (i=0 ; i<len ; i++) {
+		image[i] = tmpl[i] + mult[i] * base;
+	}
+}
+
+#ifdef EREBASE_X86
+
+// -----------------------------------------------------------------------
+__attribute__((target("sse2")))
+static void erebase_dense_sse2(const uint16_t *tmpl, const uint16_t *mult, uint16_t base, uint16_t *image, unsigned len)
+{
+	unsigned i = 0;
+	const __m128i b = _mm_set1_epi16(base);
+
+	for ( ; i+8 <= len ; i+=8) {
+		__m128i t = _mm_loadu_si128((const __m128i*) (tmpl + i));
+		__m128i m = _mm_loadu_si128((const __m128i*) (mult + i));
+		_mm_storeu_si128((__m128i*) (image + i), _mm_add_epi16(t, _mm_mullo_epi16(m, b)));
+	}
+
+	erebase_dense_scalar(tmpl + i, mult + i, base, image + i, len - i);
+}
+
+// -----------------------------------------------------------------------
+__attribute__((target("avx2")))
+static void erebase_dense_avx2(const uint16_t *tmpl, const uint16_t *mult, uint16_t base, uint16_t *image, unsigned len)
+{
+	unsigned i = 0;
+	const __m256i b = _mm256_set1_epi16(base);
+
+	for ( ; i+16 <= len ; i+=16) {
+		__m256i t = _mm256_loadu_si256((const __m256i*) (tmpl + i));
+		__m256i m = _mm256_loadu_si256((const __m256i*) (mult + i));
+		_mm256_storeu_si256((__m256i*) (image + i), _mm256_add_epi16(t, _mm256_mullo_epi16(m, b)));
+	}
+
+	erebase_dense_scalar(tmpl + i, mult + i, base, image + i, len - i);
+}
+
+static void (*erebase_dense_kernel)(const uint16_t *tmpl, const uint16_t *mult, uint16_t base, uint16_t *image, unsigned len) = erebase_dense_scalar;
+
+// -----------------------------------------------------------------------
+__attribute__((constructor))
+static void erebase_init(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		erebase_dense_kernel = erebase_dense_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		erebase_dense_kernel = erebase_dense_sse2;
+	}
+}
+
+#else
+
+static void (* const erebase_dense_kernel)(const uint16_t *tmpl, const uint16_t *mult, uint16_t base, uint16_t *image, unsigned len) = erebase_dense_scalar;
+
+#endif
+
+// -----------------------------------------------------------------------
+static void erebase_sparse(const struct emelf_rebase *rb, uint16_t base, uint16_t *image)
+{
+	unsigned g, i;
+
+	memcpy(image, rb->image, rb->size * sizeof(uint16_t));
+
+	for (g=0 ; g<rb->group_count ; g++) {
+		uint16_t add = rb->group_mult[g] * base;
+		const uint16_t *addr = rb->addr;
+		for (i=rb->group_start[g] ; i<rb->group_start[g+1] ; i++) {
+			image[addr[i]] += add;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+int emelf_rebase_apply(const struct emelf_rebase *rb, unsigned base, uint16_t *image)
+{
+	assert(rb && image);
+
+	if (base + rb->size > rb->amax) {
+		return EMELF_E_ADDR;
+	}
+
+	if (rb->mult) {
+		erebase_dense_kernel(rb->image, rb->mult, base, image, rb->size);
+	} else {
+		erebase_sparse(rb, base, image);
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+unsigned emelf_rebase_size(const struct emelf_rebase *rb)
+{
+	return rb->size;
+}
+
+// -----------------------------------------------------------------------
+void emelf_rebase_destroy(struct emelf_rebase *rb)
+{
+	if (!rb) {
+		return;
+	}
+
+	free(rb->image);
+	free(rb->mult);
+	free(rb->group_mult);
+	free(rb->group_start);
+	free(rb->addr);
+	free(rb);
+}
+
+// vim: tabstop=4 autoindent
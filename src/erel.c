@@ -0,0 +1,221 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "emelf.h"
+#include "erel.h"
+#include "estats.h"
+
+#define EREL_BATCHES ((IMAGE_MAX >> EREL_BATCH_SHIFT) + 1)
+
+struct erel_work {
+	const struct erel *r;
+	struct emelf_reloc *sorted;
+	unsigned start[EREL_BATCHES + 1];
+	int next;
+};
+
+// Measured cost of the sequential and parallel path in ns per 1024
+// relocations (0 = not measured yet), for large tables applied with
+// automatic thread count.
+static unsigned erel_cost[2];
+
+// -----------------------------------------------------------------------
+static inline void erel_one(const struct erel *r, const struct emelf_reloc *rel)
+{
+	// relocation flags are mixed randomly in real objects,
+	// so everything is done with masks instead of branches
+	unsigned flags = rel->flags;
+	unsigned byte = (flags >> 3) & 1;
+	unsigned base_mask = -(flags & EMELF_RELOC_BASE);
+	unsigned sym_mask = -((flags >> 1) & 1);
+	unsigned neg_mask = -((flags >> 2) & 1);
+	unsigned idx = rel->sym_idx & sym_mask;
+
+	// byte relocations get byte addresses
+	unsigned s = (r->value[idx] << (byte & r->addr[idx])) & sym_mask;
+	unsigned v = r->image[rel->addr];
+
+	v += (r->base << byte) & base_mask;
+	v += (s ^ neg_mask) - neg_mask;
+
+	r->image[rel->addr] = v;
+}
+
+// -----------------------------------------------------------------------
+int erel_check(const struct erel *r)
+{
+	unsigned i;
+	unsigned bad_addr = 0;
+	unsigned bad_sym = 0;
+
+	// whole table is checked before anything is applied
+	for (i=0 ; i<r->count ; i++) {
+		const struct emelf_reloc *rel = r->reloc + i;
+		bad_addr |= rel->addr >= r->image_size;
+		bad_sym |= ((rel->flags >> 1) & 1) & (rel->sym_idx >= r->symbol_count);
+	}
+
+	if (bad_addr) {
+		return EMELF_E_ADDR;
+	}
+	if (bad_sym) {
+		return EMELF_E_SECTION;
+	}
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+void erel_apply_seq(const struct erel *r)
+{
+	unsigned i;
+
+	for (i=0 ; i<r->count ; i++) {
+		erel_one(r, r->reloc + i);
+	}
+}
+
+// -----------------------------------------------------------------------
+static void * erel_worker(void *arg)
+{
+	struct erel_work *w = arg;
+	int b;
+
+	// batches cover disjoint address ranges, no locking needed
+	while ((b = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < EREL_BATCHES) {
+		unsigned i;
+		for (i=w->start[b] ; i<w->start[b+1] ; i++) {
+			erel_one(w->r, w->sorted + i);
+		}
+	}
+
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+static int erel_apply_par(const struct erel *r, int threads)
+{
+	unsigned i;
+	int t;
+	int started;
+	pthread_t *tid;
+	struct erel_work w;
+
+	// counting sort into address batches (stable, so relocations
+	// of the same word keep their order)
+	w.r = r;
+	w.next = 0;
+	w.sorted = malloc(r->count * sizeof(struct emelf_reloc));
+	tid = malloc(threads * sizeof(pthread_t));
+	if (!w.sorted || !tid) {
+		free(w.sorted);
+		free(tid);
+		return EMELF_E_ALLOC;
+	}
+
+	unsigned pos[EREL_BATCHES] = { 0 };
+	for (i=0 ; i<r->count ; i++) {
+		pos[r->reloc[i].addr >> EREL_BATCH_SHIFT]++;
+	}
+	w.start[0] = 0;
+	for (t=0 ; t<EREL_BATCHES ; t++) {
+		w.start[t+1] = w.start[t] + pos[t];
+		pos[t] = w.start[t];
+	}
+	for (i=0 ; i<r->count ; i++) {
+		w.sorted[pos[r->reloc[i].addr >> EREL_BATCH_SHIFT]++] = r->reloc[i];
+	}
+
+	// calling thread works too
+	for (started=0 ; started<threads-1 ; started++) {
+		if (pthread_create(tid + started, NULL, erel_worker, &w)) {
+			break;
+		}
+	}
+	erel_worker(&w);
+	for (t=0 ; t<started ; t++) {
+		pthread_join(tid[t], NULL);
+	}
+
+	free(w.sorted);
+	free(tid);
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+static int erel_apply_auto(const struct erel *r, int threads)
+{
+	int res = EMELF_E_OK;
+	unsigned seq = __atomic_load_n(erel_cost, __ATOMIC_RELAXED);
+	unsigned par = __atomic_load_n(erel_cost + 1, __ATOMIC_RELAXED);
+
+	// Each path is tried once, then the cheaper one is used. Its cost
+	// keeps being updated, so it is dropped once it gets more expensive
+	// than the other one was. Races between threads only mix up samples.
+	int use_par = !seq ? 0 : !par ? 1 : par < seq;
+
+	uint64_t start = estats_now();
+	if (use_par) {
+		res = erel_apply_par(r, threads);
+	} else {
+		erel_apply_seq(r);
+	}
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+	unsigned cost = (estats_now() - start) * 1024 / r->count + 1;
+
+	unsigned old = use_par ? par : seq;
+	__atomic_store_n(erel_cost + use_par, old ? (3 * old + cost) / 4 : cost, __ATOMIC_RELAXED);
+
+	return EMELF_E_OK;
+}
+
+// -----------------------------------------------------------------------
+int erel_apply(const struct erel *r, int threads)
+{
+	int res;
+	int automatic = threads <= 0;
+
+	res = erel_check(r);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	if (automatic) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if ((threads <= 1) || (r->count < EREL_PARALLEL_MIN)) {
+		erel_apply_seq(r);
+		return EMELF_E_OK;
+	}
+
+	if (automatic) {
+		return erel_apply_auto(r, threads);
+	}
+
+	return erel_apply_par(r, threads);
+}
+
+// vim: tabstop=4 autoindent
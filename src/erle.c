@@ -0,0 +1,155 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <string.h>
+
+#include "erle.h"
+
+enum erle_states {
+	ERLE_ZEROS,
+	ERLE_LITERALS,
+	ERLE_COPY,
+};
+
+// -----------------------------------------------------------------------
+static unsigned erle_zeros(const uint16_t *src, unsigned len, unsigned max)
+{
+	unsigned i = 0;
+
+	if (len > max) {
+		len = max;
+	}
+	while ((i < len) && !src[i]) {
+		i++;
+	}
+
+	return i;
+}
+
+// -----------------------------------------------------------------------
+// Find the next record of len words at src. Stores its zero and literal
+// counts (literals are the last words it covers), returns words covered.
+unsigned erle_record(const uint16_t *src, unsigned len, unsigned *zeros, unsigned *literals)
+{
+	unsigned i = erle_zeros(src, len, 65535);
+	if (i < ERLE_MIN_ZEROS) {
+		i = 0;
+	}
+	*zeros = i;
+
+	// literals run until a long enough zero run
+	unsigned start = i;
+	while ((i < len) && (i - start < 65535)) {
+		if (src[i]) {
+			i++;
+			continue;
+		}
+		unsigned z = erle_zeros(src + i, len - i, ERLE_MIN_ZEROS);
+		if ((z >= ERLE_MIN_ZEROS) || (i - start + z > 65535)) {
+			break;
+		}
+		i += z;
+	}
+	*literals = i - start;
+
+	return i;
+}
+
+// -----------------------------------------------------------------------
+// Encode len words from src. With dst == NULL only the encoded length is returned.
+unsigned erle_encode(const uint16_t *src, unsigned len, uint16_t *dst)
+{
+	unsigned i = 0;
+	unsigned out = 0;
+	unsigned zeros;
+	unsigned literals;
+
+	while (i < len) {
+		i += erle_record(src + i, len - i, &zeros, &literals);
+		if (dst) {
+			dst[out] = zeros;
+			dst[out+1] = literals;
+			memcpy(dst + out + 2, src + i - literals, literals * sizeof(uint16_t));
+		}
+		out += 2 + literals;
+	}
+
+	return out;
+}
+
+// -----------------------------------------------------------------------
+void erle_dec_init(struct erle_dec *d, uint16_t *dst, unsigned size)
+{
+	d->dst = dst;
+	d->size = size;
+	d->pos = 0;
+	d->left = 0;
+	d->state = ERLE_ZEROS;
+}
+
+// -----------------------------------------------------------------------
+// Decode next part of encoded data. Returns 0 on success, -1 if data doesn't fit.
+int erle_decode(struct erle_dec *d, const uint16_t *src, unsigned len)
+{
+	while (len > 0) {
+		switch (d->state) {
+			case ERLE_ZEROS:
+				if (*src > d->size - d->pos) {
+					return -1;
+				}
+				memset(d->dst + d->pos, 0, *src * sizeof(uint16_t));
+				d->pos += *src;
+				src++;
+				len--;
+				d->state = ERLE_LITERALS;
+				break;
+			case ERLE_LITERALS:
+				if (*src > d->size - d->pos) {
+					return -1;
+				}
+				d->left = *src;
+				src++;
+				len--;
+				d->state = d->left ? ERLE_COPY : ERLE_ZEROS;
+				break;
+			case ERLE_COPY: {
+				unsigned n = d->left < len ? d->left : len;
+				memcpy(d->dst + d->pos, src, n * sizeof(uint16_t));
+				d->pos += n;
+				d->left -= n;
+				src += n;
+				len -= n;
+				if (!d->left) {
+					d->state = ERLE_ZEROS;
+				}
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+// Check if the whole image has been decoded.
+int erle_dec_done(struct erle_dec *d)
+{
+	return (d->state == ERLE_ZEROS) && (d->pos == d->size) ? 0 : -1;
+}
+
+// vim: tabstop=4 autoindent
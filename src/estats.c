@@ -0,0 +1,229 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+// Statistics are collected through a wrapper around object's allocator:
+// a block allocated along with the object holds its counters and the
+// wrapper. Counters are updated atomically, since objects may be shared
+// between threads (indexes get built on first lookup).
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emelf.h"
+#include "ealloc.h"
+#include "estats.h"
+
+int estats_on;
+__thread uint64_t estats_swap_ns;
+
+static struct emelf_stats estats_global;
+
+struct estats_block {
+	struct emelf_stats s;
+	struct emelf_allocator alloc;
+	const struct emelf_allocator *user;
+};
+
+// -----------------------------------------------------------------------
+static void estats_add(unsigned long long *counter, unsigned long long v)
+{
+	__atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+// -----------------------------------------------------------------------
+static void estats_alloc_count(struct estats_block *b, size_t size)
+{
+	estats_add(&b->s.allocs, 1);
+	estats_add(&b->s.alloc_bytes, size);
+	estats_add(&estats_global.allocs, 1);
+	estats_add(&estats_global.alloc_bytes, size);
+}
+
+// -----------------------------------------------------------------------
+static void * estats_alloc(void *ctx, size_t size)
+{
+	struct estats_block *b = ctx;
+	void *ptr = b->user->alloc(b->user->ctx, size);
+
+	if (ptr) {
+		estats_alloc_count(b, size);
+	}
+
+	return ptr;
+}
+
+// -----------------------------------------------------------------------
+static void * estats_realloc(void *ctx, void *ptr, size_t old_size, size_t size)
+{
+	struct estats_block *b = ctx;
+	void *nptr = b->user->realloc(b->user->ctx, ptr, old_size, size);
+
+	if (nptr) {
+		estats_alloc_count(b, size);
+	}
+
+	return nptr;
+}
+
+// -----------------------------------------------------------------------
+static void estats_free(void *ctx, void *ptr, size_t size)
+{
+	struct estats_block *b = ctx;
+
+	if (ptr) {
+		estats_add(&b->s.frees, 1);
+		estats_add(&estats_global.frees, 1);
+	}
+
+	b->user->free(b->user->ctx, ptr, size);
+}
+
+// -----------------------------------------------------------------------
+uint64_t estats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// -----------------------------------------------------------------------
+void estats_attach(struct emelf *e)
+{
+	if (!__atomic_load_n(&estats_on, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	// no stats for the object if there is no memory for them
+	struct estats_block *b = ea_zalloc(e->alloc, sizeof(struct estats_block));
+	if (!b) {
+		return;
+	}
+
+	b->user = e->alloc;
+	b->alloc.alloc = estats_alloc;
+	b->alloc.realloc = estats_realloc;
+	b->alloc.free = estats_free;
+	b->alloc.ctx = b;
+
+	e->alloc = &b->alloc;
+	e->stats = &b->s;
+
+	// object itself has been allocated already
+	estats_alloc_count(b, SIZE_EMELF);
+}
+
+// -----------------------------------------------------------------------
+const struct emelf_allocator * estats_detach(struct emelf *e)
+{
+	if (!e->stats) {
+		return e->alloc;
+	}
+
+	struct estats_block *b = (struct estats_block*) e->stats;
+	const struct emelf_allocator *a = b->user;
+
+	// object itself is freed by the caller
+	estats_add(&estats_global.frees, 1);
+
+	e->alloc = a;
+	e->stats = NULL;
+	ea_free(a, b, sizeof(struct estats_block));
+
+	return a;
+}
+
+// -----------------------------------------------------------------------
+uint64_t estats_start(void)
+{
+	if (!__atomic_load_n(&estats_on, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+
+	estats_swap_ns = 0;
+
+	return estats_now();
+}
+
+// -----------------------------------------------------------------------
+static void estats_op(struct emelf_op_stats *s, uint64_t bytes, uint64_t ns)
+{
+	estats_add(&s->count, 1);
+	estats_add(&s->bytes, bytes);
+	estats_add(&s->ns, ns);
+}
+
+// -----------------------------------------------------------------------
+void estats_section(struct emelf *e, int type, int op, uint64_t bytes, uint64_t start)
+{
+	if (!start || (type <= EMELF_SEC_UNKNOWN) || (type >= EMELF_SEC_MAX)) {
+		return;
+	}
+
+	uint64_t ns = estats_now() - start;
+	uint64_t swap_ns = estats_swap_ns;
+
+	if (e->stats) {
+		estats_op(&e->stats->sec[type][op], bytes, ns);
+		if (swap_ns) {
+			estats_op(&e->stats->sec[type][EMELF_STAT_SWAP], bytes, swap_ns);
+		}
+	}
+	estats_op(&estats_global.sec[type][op], bytes, ns);
+	if (swap_ns) {
+		estats_op(&estats_global.sec[type][EMELF_STAT_SWAP], bytes, swap_ns);
+	}
+}
+
+// -----------------------------------------------------------------------
+void emelf_stats_enable(int on)
+{
+	__atomic_store_n(&estats_on, on, __ATOMIC_RELAXED);
+}
+
+// -----------------------------------------------------------------------
+const struct emelf_stats * emelf_stats_get(struct emelf *e)
+{
+	return e->stats;
+}
+
+// -----------------------------------------------------------------------
+void emelf_stats_global(struct emelf_stats *s)
+{
+	unsigned i;
+	unsigned long long *dst = (unsigned long long*) s;
+	unsigned long long *src = (unsigned long long*) &estats_global;
+
+	// all counters are of the same type
+	for (i=0 ; i<sizeof(struct emelf_stats) / sizeof(unsigned long long) ; i++) {
+		dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+	}
+}
+
+// -----------------------------------------------------------------------
+void emelf_stats_reset(void)
+{
+	unsigned i;
+	unsigned long long *c = (unsigned long long*) &estats_global;
+
+	for (i=0 ; i<sizeof(struct emelf_stats) / sizeof(unsigned long long) ; i++) {
+		__atomic_store_n(c + i, 0, __ATOMIC_RELAXED);
+	}
+}
+
+// vim: tabstop=4 autoindent
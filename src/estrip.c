@@ -0,0 +1,181 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "emelf.h"
+#include "edh.h"
+#include "eaddr.h"
+#include "ealloc.h"
+#include "erel.h"
+#include "estrtab.h"
+
+// -----------------------------------------------------------------------
+static void estrip_sections_remove(struct emelf *e, unsigned types)
+{
+	int i;
+	int count = 0;
+
+	for (i=0 ; i<e->eh.sec_count ; i++) {
+		if (!(types & (1 << e->section[i].type))) {
+			e->section[count++] = e->section[i];
+		}
+	}
+
+	e->eh.sec_count = count;
+}
+
+// -----------------------------------------------------------------------
+static int estrip_relocs(struct emelf *e, char *used)
+{
+	int i;
+	int count = 0;
+
+	for (i=0 ; i<e->reloc_count ; i++) {
+		struct emelf_reloc r = e->reloc[i];
+		unsigned byte = (r.flags & EMELF_RELOC_BYTE) ? 1 : 0;
+
+		// references to symbols defined here are resolved into the image,
+		// for relative symbols base relocation is still needed (but can't
+		// be negative or added twice)
+		struct emelf_symbol *s = (r.flags & EMELF_RELOC_SYM) ? e->symbol + r.sym_idx : NULL;
+		if (s && (s->flags & EMELF_SYM_GLOBAL)) {
+			if (!(s->flags & EMELF_SYM_RELATIVE)) {
+				e->image[r.addr] += (r.flags & EMELF_RELOC_SYM_NEG) ? -s->value : s->value;
+				r.flags &= ~(EMELF_RELOC_SYM | EMELF_RELOC_SYM_NEG);
+			} else if (!(r.flags & (EMELF_RELOC_SYM_NEG | EMELF_RELOC_BASE))) {
+				e->image[r.addr] += s->value << byte;
+				r.flags = (r.flags & ~EMELF_RELOC_SYM) | EMELF_RELOC_BASE;
+			}
+		}
+
+		// relocations with neither base nor symbol do nothing
+		if (!(r.flags & (EMELF_RELOC_BASE | EMELF_RELOC_SYM))) {
+			continue;
+		}
+		if (r.flags & EMELF_RELOC_SYM) {
+			used[r.sym_idx] = 1;
+		} else {
+			r.sym_idx = 0;
+		}
+		e->reloc[count++] = r;
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------
+static int estrip_symbols(struct emelf *e, char *used, uint16_t *idx)
+{
+	int i;
+	int count = 0;
+
+	// nothing links against executables, so only relocatable objects
+	// need their global symbols
+	for (i=0 ; i<e->symbol_count ; i++) {
+		struct emelf_symbol *s = e->symbol + i;
+		if (used[i] || ((e->eh.type == EMELF_RELOC) && (s->flags & EMELF_SYM_GLOBAL))) {
+			idx[i] = count;
+			e->symbol[count++] = *s;
+		}
+	}
+
+	for (i=0 ; i<e->reloc_count ; i++) {
+		if (e->reloc[i].flags & EMELF_RELOC_SYM) {
+			e->reloc[i].sym_idx = idx[e->reloc[i].sym_idx];
+		}
+	}
+
+	return count;
+}
+
+// -----------------------------------------------------------------------
+int emelf_strip(struct emelf *e)
+{
+	assert(e);
+
+	int res;
+	char *used = NULL;
+	uint16_t *idx = NULL;
+
+	if (e->map) {
+		return EMELF_E_RDONLY;
+	}
+
+	res = emelf_sections_load(e);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	// nothing is changed if any relocation is broken
+	struct erel r = {
+		e->image, e->image_size, 0,
+		e->reloc, e->reloc_count,
+		NULL, NULL, e->symbol_count
+	};
+	res = erel_check(&r);
+	if (res != EMELF_E_OK) {
+		return res;
+	}
+
+	used = calloc(e->symbol_count + 1, 1);
+	idx = malloc((e->symbol_count + 1) * sizeof(uint16_t));
+	if (!used || !idx) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+
+	e->reloc_count = estrip_relocs(e, used);
+	int symbol_count = estrip_symbols(e, used, idx);
+
+	if (symbol_count != e->symbol_count) {
+		edh_destroy(e->hsymbol);
+		e->hsymbol = NULL;
+		eaddr_destroy(e->haddr);
+		e->haddr = NULL;
+		e->symbol_count = symbol_count;
+		e->symbol_names_packed = -1;
+	}
+
+	// empty sections go away (and get added again with new contents)
+	if (!e->reloc_count) {
+		ea_free(e->alloc, e->reloc, e->reloc_slots * SIZE_RELOC);
+		e->reloc = NULL;
+		e->reloc_slots = 0;
+		estrip_sections_remove(e, 1 << EMELF_SEC_RELOC);
+	}
+	if (!e->symbol_count) {
+		ea_free(e->alloc, e->symbol, e->symbol_slots * SIZE_SYMBOL);
+		ea_free(e->alloc, e->symbol_names, e->symbol_names_space);
+		e->symbol = NULL;
+		e->symbol_names = NULL;
+		e->symbol_slots = e->symbol_names_space = e->symbol_names_len = 0;
+		e->symbol_names_packed = 0;
+		estrip_sections_remove(e, (1 << EMELF_SEC_SYM) | (1 << EMELF_SEC_SYM_NAMES) | (1 << EMELF_SEC_SYM_HASH));
+	} else {
+		// drop names of removed symbols
+		res = estrtab_pack(e);
+	}
+
+cleanup:
+	free(used);
+	free(idx);
+	return res;
+}
+
+// vim: tabstop=4 autoindent
@@ -0,0 +1,121 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "emelf.h"
+#include "eerr.h"
+#include "estrtab.h"
+#include "ealloc.h"
+
+struct estrtab_name {
+	const char *name;
+	unsigned len;
+	unsigned idx;
+};
+
+// -----------------------------------------------------------------------
+static int estrtab_name_cmp(const void *a, const void *b)
+{
+	const struct estrtab_name *na = a;
+	const struct estrtab_name *nb = b;
+	const unsigned char *pa = (const unsigned char*) na->name + na->len;
+	const unsigned char *pb = (const unsigned char*) nb->name + nb->len;
+	unsigned len = na->len < nb->len ? na->len : nb->len;
+
+	// compare reversed names, a suffix goes before names that end with it
+	while (len--) {
+		pa--;
+		pb--;
+		if (*pa != *pb) {
+			return (int) *pa - (int) *pb;
+		}
+	}
+
+	return (na->len > nb->len) - (na->len < nb->len);
+}
+
+// -----------------------------------------------------------------------
+int estrtab_pack(struct emelf *e)
+{
+	int i;
+	int res = EMELF_E_OK;
+	unsigned space = 1;
+	unsigned pos = 0;
+	char *names = NULL;
+
+	// mapped names are a read-only view, nothing new to pack otherwise
+	if (e->map || (e->symbol_count == e->symbol_names_packed)) {
+		return EMELF_E_OK;
+	}
+
+	struct estrtab_name *sorted = ea_alloc(e->alloc, e->symbol_count * sizeof(struct estrtab_name));
+	if (!sorted) {
+		return EMELF_E_ALLOC;
+	}
+
+	for (i=0 ; i<e->symbol_count ; i++) {
+		sorted[i].name = e->symbol_names + e->symbol[i].offset;
+		sorted[i].len = strlen(sorted[i].name);
+		sorted[i].idx = i;
+		space += sorted[i].len + 1;
+	}
+
+	qsort(sorted, e->symbol_count, sizeof(struct estrtab_name), estrtab_name_cmp);
+
+	names = ea_alloc(e->alloc, space);
+	if (!names) {
+		res = EMELF_E_ALLOC;
+		goto cleanup;
+	}
+
+	// going backwards, names ending with the current one are just before it,
+	// and if any of them ends with it, the previous (longer) one does too
+	struct estrtab_name *prev = NULL;
+	unsigned prev_offset = 0;
+	for (i=e->symbol_count-1 ; i>=0 ; i--) {
+		struct estrtab_name *n = sorted + i;
+		struct emelf_symbol *s = e->symbol + n->idx;
+		if (prev && (prev->len >= n->len) && !memcmp(prev->name + prev->len - n->len, n->name, n->len)) {
+			s->offset = prev_offset + prev->len - n->len;
+		} else {
+			memcpy(names + pos, n->name, n->len + 1);
+			s->offset = pos;
+			pos += n->len + 1;
+		}
+		prev = n;
+		prev_offset = s->offset;
+	}
+
+	// table is padded to 16 bits as a whole
+	if (pos % 2) {
+		names[pos++] = '\0';
+	}
+
+	ea_free(e->alloc, e->symbol_names, e->symbol_names_space);
+	e->symbol_names = names;
+	e->symbol_names_space = space;
+	e->symbol_names_len = pos;
+	e->symbol_names_packed = e->symbol_count;
+
+cleanup:
+	ea_free(e->alloc, sorted, e->symbol_count * sizeof(struct estrtab_name));
+	return res;
+}
+
+// vim: tabstop=4 autoindent
@@ -0,0 +1,185 @@
+//  Copyright (c) 2014 Jakub Filipowicz <jakubf@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc.,
+//  51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+// Big-endian <-> host conversion of 16-bit word arrays.
+// On x86 SSSE3 or AVX2 byte-shuffle kernels are selected at runtime,
+// scalar code is used everywhere else (and for the tails).
+
+#include <string.h>
+
+#include "eswap.h"
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define ESWAP_NATIVE
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define ESWAP_X86
+#include <immintrin.h>
+#endif
+
+#ifndef ESWAP_NATIVE
+
+// -----------------------------------------------------------------------
+static void eswap_copy_scalar(uint16_t *dst, const uint16_t *src, size_t len)
+{
+	size_t i = 0;
+	size_t j;
+
+	// in place and in fixed-size blocks the compiler vectorizes it
+	// without alias checks or loop versioning
+	if (dst != src) {
+		memmove(dst, src, len * sizeof(uint16_t));
+	}
+	for ( ; i+16 <= len ; i+=16) {
+		for (j=i ; j<i+16 ; j++) {
+			dst[j] = (uint16_t) ((dst[j] >> 8) | (dst[j] << 8));
+		}
+	}
+	for ( ; i<len ; i++) {
+		dst[i] = (uint16_t) ((dst[i] >> 8) | (dst[i] << 8));
+	}
+}
+
+#ifdef ESWAP_X86
+
+// -----------------------------------------------------------------------
+__attribute__((target("ssse3")))
+static void eswap_copy_ssse3(uint16_t *dst, const uint16_t *src, size_t len)
+{
+	size_t i = 0;
+	const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+
+	// four independent shuffles per iteration, single ones stall on load latency
+	for ( ; i+32 <= len ; i+=32) {
+		__m128i v0 = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i*) (src + i + 8));
+		__m128i v2 = _mm_loadu_si128((const __m128i*) (src + i + 16));
+		__m128i v3 = _mm_loadu_si128((const __m128i*) (src + i + 24));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_shuffle_epi8(v0, mask));
+		_mm_storeu_si128((__m128i*) (dst + i + 8), _mm_shuffle_epi8(v1, mask));
+		_mm_storeu_si128((__m128i*) (dst + i + 16), _mm_shuffle_epi8(v2, mask));
+		_mm_storeu_si128((__m128i*) (dst + i + 24), _mm_shuffle_epi8(v3, mask));
+	}
+	for ( ; i+8 <= len ; i+=8) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_shuffle_epi8(v, mask));
+	}
+
+	eswap_copy_scalar(dst + i, src + i, len - i);
+}
+
+// -----------------------------------------------------------------------
+__attribute__((target("avx2")))
+static void eswap_copy_avx2(uint16_t *dst, const uint16_t *src, size_t len)
+{
+	size_t i = 0;
+	const __m256i mask = _mm256_set_epi8(
+		14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+		14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1
+	);
+
+	for ( ; i+32 <= len ; i+=32) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i*) (src + i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i*) (src + i + 16));
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(v0, mask));
+		_mm256_storeu_si256((__m256i*) (dst + i + 16), _mm256_shuffle_epi8(v1, mask));
+	}
+	for ( ; i+16 <= len ; i+=16) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (src + i));
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(v, mask));
+	}
+
+	eswap_copy_scalar(dst + i, src + i, len - i);
+}
+
+static const struct eswap_kernel eswap_kernel_list[] = {
+	{ "scalar", eswap_copy_scalar },
+	{ "ssse3", eswap_copy_ssse3 },
+	{ "avx2", eswap_copy_avx2 },
+};
+
+// kernels up to this one are supported by the CPU, the last one is used
+static int eswap_kernel_count = 1;
+static void (*eswap_copy_kernel)(uint16_t *dst, const uint16_t *src, size_t len) = eswap_copy_scalar;
+
+// -----------------------------------------------------------------------
+__attribute__((constructor))
+static void eswap_init(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		eswap_kernel_count = 3;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		eswap_kernel_count = 2;
+	}
+	eswap_copy_kernel = eswap_kernel_list[eswap_kernel_count-1].copy;
+}
+
+#else
+
+static const struct eswap_kernel eswap_kernel_list[] = {
+	{ "scalar", eswap_copy_scalar },
+};
+
+static const int eswap_kernel_count = 1;
+static void (* const eswap_copy_kernel)(uint16_t *dst, const uint16_t *src, size_t len) = eswap_copy_scalar;
+
+#endif
+
+#else
+
+// -----------------------------------------------------------------------
+static void eswap_copy_native(uint16_t *dst, const uint16_t *src, size_t len)
+{
+	memmove(dst, src, len * sizeof(uint16_t));
+}
+
+static const struct eswap_kernel eswap_kernel_list[] = {
+	{ "native", eswap_copy_native },
+};
+
+static const int eswap_kernel_count = 1;
+
+#endif
+
+// -----------------------------------------------------------------------
+const struct eswap_kernel * eswap_kernels(int *count)
+{
+	*count = eswap_kernel_count;
+	return eswap_kernel_list;
+}
+
+// -----------------------------------------------------------------------
+void eswap(uint16_t *t, size_t len)
+{
+#ifndef ESWAP_NATIVE
+	// all kernels handle dst == src
+	eswap_copy_kernel(t, t, len);
+#endif
+}
+
+// -----------------------------------------------------------------------
+void eswap_copy(uint16_t *dst, const uint16_t *src, size_t len)
+{
+#ifdef ESWAP_NATIVE
+	memmove(dst, src, len * sizeof(uint16_t));
+#else
+	eswap_copy_kernel(dst, src, len);
+#endif
+}
+
+// vim: tabstop=4 autoindent